@@ -22,685 +22,517 @@
 
 #include "CH376.h"
 
-CH376::CH376(uint8_t spiSelect, uint8_t intPin, SPISettings speed) {
-	_intPin = intPin;
-	_spiChipSelect = spiSelect;
-	_spiSpeed = speed;
-}
-CH376::CH376(uint8_t spiSelect, SPISettings speed) {
-	_intPin = MISO;
-	_spiChipSelect = spiSelect;
-	_spiSpeed = speed;
-}
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+CH376::CH376(CH376SerialType& serialPort, uint32_t speed) : _port(serialPort, speed) {}
+#elif CH376_TRANSPORT == CH376_TRANSPORT_PARALLEL
+CH376::CH376(const uint8_t dataPins[8], uint8_t a0Pin, uint8_t wrPin, uint8_t rdPin, uint8_t csPin) : _port(dataPins, a0Pin, wrPin, rdPin, csPin) {}
+#elif CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+CH376::CH376(CH376LinuxHAL& hal) : _port(hal) {}
+#else
+CH376::CH376(uint8_t spiSelect, uint8_t intPin, SPIClock speed) : _port(SPI, spiSelect, intPin, speed) {}
+CH376::CH376(uint8_t spiSelect, SPIClock speed) : _port(SPI, spiSelect, SPI_INT_SDO, speed) {}
+CH376::CH376(SPIClass& spiBus, uint8_t spiSelect, uint8_t intPin, SPIClock speed) : _port(spiBus, spiSelect, intPin, speed) {}
+CH376::CH376(SPIClass& spiBus, uint8_t spiSelect, SPIClock speed) : _port(spiBus, spiSelect, SPI_INT_SDO, speed) {}
+#endif
 CH376::~CH376() {
 	//  Auto-generated destructor stub
 }
 
 void CH376::init() {
 	delay(60);
-	if (_intPin != MISO) {
-		pinMode(_intPin, INPUT_PULLUP);
+	_port.begin();
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+	if (_port.speed() != BaudRate9600) { // the chip keeps a raised baud rate over an MCU-only reset
+		_port.open(_port.speed());
+		run<CmdResetAll>();
+		delay(100);
+		_port.open(BaudRate9600);
 	}
-	pinMode(_spiChipSelect, OUTPUT);
-	digitalWrite(_spiChipSelect, HIGH);
-	SPI.begin();
-	resetAll();
+#endif
+	run<CmdResetAll>();
 	delay(100);
-	if (_intPin == MISO) {
-		setSDOINT(0x16, 0x90); //10H=DISABLE SDO PIN FOR INTERRUPT OUTPUT
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+	if (_port.speed() != BaudRate9600) {
+		raiseBaudrate();
+	}
+#elif CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	if (_port.sdoInterrupt()) {
+		run<CmdSetSDOInt>(0x16, 0x90); //10H=DISABLE SDO PIN FOR INTERRUPT OUTPUT
 	}
+	if (_clockMax && _port.clock()) negotiateClock(); // not with an SPISettings speed, its rate can't be read back
+#endif
 	_controllerReady = pingDevice();
 	setMode();
 }
-bool CH376::pingDevice(byte value) { return (CheckExist(value) == (255 - value)); }
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+bool CH376::setSPIPins(uint8_t sckPin, uint8_t misoPin, uint8_t mosiPin) { return _port.setPins(sckPin, misoPin, mosiPin); }
+void CH376::setAutoClock(SPIClock maxSpeed) { _clockMax = maxSpeed.hz; }
+uint32_t CH376::getSPIClock() { return _port.clock(); }
+uint32_t CH376::getPollBusTime() { return _pollBusTime; }
+uint32_t CH376::getPollCount() { return _pollCount; }
+void CH376::resetPollStats() {
+	_pollBusTime = 0;
+	_pollCount = 0;
+}
+#endif
+bool CH376::pingDevice(byte value) { return (run<CmdCheckExist>(value) == (255 - value)); }
 bool CH376::getDeviceAttached() { return _deviceAttached; }
 bool CH376::getControllerReady() { return _controllerReady; }
-bool CH376::setMode(USB_MODE mode) { return (setUSBMode(mode) == CMD_RET_SUCCESS); }
-void CH376::setSpeed(USB_SPEED speed) { setUSBSpeed(speed); }
+bool CH376::setMode(USB_MODE mode) {
+	uint8_t tmpRet = run<CmdSetUSBMode>(mode);
+	delayMicroseconds(40); // let the USB port settle in the new mode
+	return (tmpRet == CMD_RET_SUCCESS);
+}
+void CH376::setSpeed(USB_SPEED speed) { run<CmdSetUSBSpeed>(speed); }
 void CH376::setError(uint8_t errCode) {
 	_errorCode = errCode;
 	_deviceAttached = false;
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Error:");
-	Serial.print("\t 0x");
-	Serial.print(errCode, HEX);
-	Serial.println();
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	if (_clockMax && !_clockCheck && _port.clock() > _clockMin && !linkCheck(false)) { // garbled transfer, drop back a step
+		_port.setClock(SPIClock{max(_port.clock() / 2, _clockMin)});
+	}
+#endif
+#if CH376_TRACE_LEVEL >= CH376_TRACE_ERRORS
+	CH376_TRACE_PORT.print(F("CH376 error: 0x"));
+	CH376_TRACE_PORT.println(errCode, HEX);
 #endif
 }
 uint8_t CH376::getError() { return _errorCode; }
 void CH376::clearError() { _errorCode = 0; }
 
-#pragma region SPI
-void CH376::spiBeginTransfer() {
-	delayMicroseconds(2);
-	SPI.beginTransaction(_spiSpeed);
-	digitalWrite(_spiChipSelect, LOW);
-}
-void CH376::spiEndTransfer() {
-	digitalWrite(_spiChipSelect, HIGH);
-	SPI.endTransaction();
-}
-void CH376::spiWrite(uint8_t data) {
-	delayMicroseconds(2); // datasheet TSC min 1.5uSec
-	SPI.transfer(data);
-}
-void CH376::spiPrint(const char str[]) {
-	uint8_t stringCounter = 0;
-	while (str[stringCounter]) {
-		spiWrite(str[stringCounter]);
-		stringCounter++;
+#pragma region Port
+void CH376::portBeginTransfer() {
+	if (_cmdPending) commandStatus(); // the chip takes no command before the pending one completes
+	if (_batchHeld) {
+		_port.nextCommand();
+		return;
 	}
+	_port.beginTransfer();
+	_batchHeld = _batching;
+}
+void CH376::portEndTransfer() {
+	if (!_batching) _port.endTransfer(); // in a batch the next command follows in the same transfer
+}
+void CH376::portCommand(uint8_t command) { _port.command(command); }
+void CH376::portWrite(uint8_t data) { _port.write(data); }
+void CH376::portWriteMultiple(const uint8_t* buffer, uint16_t b_size) {
+	_port.write(buffer, b_size);
+#if CH376_TRACE_LEVEL >= CH376_TRACE_DATA
+	traceData("  >", buffer, b_size);
+#endif
 }
-uint8_t CH376::spiRead() {
-	delayMicroseconds(2); //datasheet TSC min 1.5uSec
-	return SPI.transfer(0x00);
-}
-uint8_t CH376::spiReadMultiple(uint8_t* buffer, uint8_t b_size)
-{
-	if (b_size == 0) b_size = sizeof(buffer);
-	int i;
-	for (int i = 0; i < b_size; i++)
-	{
-		uint8_t value;
-		uint8_t bytes = spiRead();
-		*(buffer + i) = value;
+void CH376::portPrint(const char str[]) { _port.write((const uint8_t*)str, strlen(str)); }
+uint8_t CH376::portRead() { return _port.read(); }
+uint16_t CH376::portReadMultiple(uint8_t* buffer, uint16_t b_size) {
+	_port.read(buffer, b_size);
+#if CH376_TRACE_LEVEL >= CH376_TRACE_DATA
+	traceData("  <", buffer, b_size);
+#endif
+	return b_size;
+}
+void CH376::portWriteAsync(const uint8_t* buffer, uint16_t b_size) {
+#if CH376_TRACE_LEVEL >= CH376_TRACE_DATA
+	traceData("  >", buffer, b_size);
+#endif
+	_port.writeAsync(buffer, b_size);
+}
+void CH376::portReadAsync(uint8_t* buffer, uint16_t b_size) { _port.readAsync(buffer, b_size); }
+void CH376::portWaitData() { _port.waitData(); }
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+void CH376::raiseBaudrate() { // serial mode: switch the chip and the port from 9600bps to the requested speed
+	uint32_t speed = _port.speed();
+	uint8_t coefficient = (speed >= BaudRate38400) ? 0x03 : 0x02; // 03H: 6MHz/(256-constant), 02H: 750kHz/(256-constant)
+	uint32_t base = (coefficient == 0x03) ? 6000000UL : 750000UL;
+	uint8_t constant = 256 - (base + speed / 2) / speed;
+
+	portBeginTransfer();
+	portCommand(CMD21_SET_BAUDRATE);
+	portWrite(coefficient);
+	portWrite(constant);
+	portEndTransfer();
+	delay(2); // let the command leave the port before it is reopened
+	_port.open(speed);
+	if (portRead() != CMD_RET_SUCCESS) { // the status is answered at the new rate
+		setError(ERR_NO_RESPONSE);
 	}
-	return i;
 }
-uint8_t CH376::waitInterrupt(bool endTransfer) {
+#endif
+uint8_t CH376::waitInterrupt() {
 	uint32_t oldMillis = millis();
-	while (digitalRead(_intPin)) {
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	uint16_t first = _pollFirst ? _pollFirst : pollDelay(0);
+	uint16_t backoff = first;
+#endif
+	while (!intPending()) {
 		if ((millis() - oldMillis) > ANSWTIMEOUT) {
 			setError(ERR_TIMEOUT);
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+			_pollFirst = 0;
+#endif
 			return 0x00;
 		}
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+		if (_port.pollInterrupt()) { // the bus is free for other devices until the next poll
+			delayMicroseconds(backoff);
+			if (backoff < 32 * first) backoff *= 2;
+		}
+#endif
 	}
-	return getInterrupt();
-}
-#pragma endregion
-
-#pragma region CMD00
-void CH376::exec00(uint8_t CMD00) {
-	spiBeginTransfer();
-	spiWrite(CMD00);
-	spiEndTransfer();
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD00, HEX);
-	Serial.println();
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	_pollFirst = 0;
 #endif
+	return takeInterrupt();
 }
-
-void CH376::abortNAK() { exec00(CMD00_ABORT_NAK); }
-void CH376::dirtyBuffer() { exec00(CMD00_DIRTY_BUFFER); }
-void CH376::enterSleep() { exec00(CMD00_ENTER_SLEEP); }
-void CH376::resetAll() { exec00(CMD00_RESET_ALL); }
-void CH376::unlockUSB() { exec00(CMD00_UNLOCK_USB); }
-#pragma endregion
-
-#pragma region CMD10
-void CH376::exec10(uint8_t CMD10, uint8_t input, bool endTransfer) {
-	spiBeginTransfer();
-	spiWrite(CMD10);
-	spiWrite(input);
-	if (endTransfer) { spiEndTransfer(); }
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD10, HEX);
-	Serial.println();
-	Serial.print("input:");
-	Serial.print("\t 0x");
-	Serial.print(input, HEX);
-	Serial.println();
-#endif // DEBUG
-}
-
-void CH376::setENDPoint2(uint8_t input) { exec10(CMD10_SET_ENDP2, input); }
-void CH376::setENDPoint3(uint8_t input) { exec10(CMD10_SET_ENDP3, input); }
-void CH376::setENDPoint4(uint8_t input) { exec10(CMD10_SET_ENDP4, input); }
-void CH376::setENDPoint5(uint8_t input) { exec10(CMD10_SET_ENDP5, input); }
-void CH376::setENDPoint6(uint8_t input) { exec10(CMD10_SET_ENDP6, input); }
-void CH376::setENDPoint7(uint8_t input) { exec10(CMD10_SET_ENDP7, input); }
-void CH376::setFileName(uint8_t input) { exec10(CMD10_SET_FILE_NAME, input); }
-void CH376::setFileName(const char* filename) {
-	spiBeginTransfer();
-	spiWrite(CMD10_SET_FILE_NAME);
-	//write(0x2f); // "/" root directory
-	spiPrint(filename); // filename
-	//write(0x5C);	// this is the "\" sign 
-	spiWrite((uint8_t)0x00);	// terminating null character
-	spiEndTransfer();
-}
-void CH376::setUSBAddress(uint8_t input) { exec10(CMD10_SET_USB_ADDR, input); }
-void CH376::setUSBSpeed(uint8_t input) { exec10(CMD10_SET_USB_SPEED, input); }
-void CH376::writeHostData(uint8_t input) { exec10(CMD10_WR_HOST_DATA, input, false); }
-void CH376::writeUSBData3(uint8_t input) { exec10(CMD10_WR_USB_DATA3, input, false); }
-void CH376::writeUSBData5(uint8_t input) { exec10(CMD10_WR_USB_DATA5, input, false); }
-void CH376::writeUSBData7(uint8_t input) { exec10(CMD10_WR_USB_DATA7, input, false); }
-#pragma endregion
-
-#pragma region CMD20
-void CH376::exec20(uint8_t CMD20, uint8_t input, uint8_t input2, bool endTransfer) {
-	spiBeginTransfer();
-	spiWrite(CMD20);
-	spiWrite(input);
-	spiWrite(input2);
-	if (endTransfer) { spiEndTransfer(); }
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD20, HEX);
-	Serial.println();
-	Serial.print("input:");
-	Serial.print("\t 0x");
-	Serial.print(input, HEX);
-	Serial.println();
-	Serial.print("input2:");
-	Serial.print("\t 0x");
-	Serial.print(input2, HEX);
-	Serial.println();
-#endif // DEBUG
-}
-
-void CH376::checkSuspended(uint8_t input, uint8_t input2) { exec20(CMD20_CHK_SUSPEND, input, input2); }
-void CH376::setRetry(uint8_t input, uint8_t input2) { exec20(CMD20_SET_RETRY, input, input2); }
-void CH376::setSDOINT(uint8_t input, uint8_t input2) { exec20(CMD20_SET_SDO_INT, input, input2); }
-void CH376::writeVAR8(uint8_t input, uint8_t input2) { exec20(CMD20_WRITE_VAR8, input, input2); }
-void CH376::writeOffsetData(uint8_t input, uint8_t input2) { exec20(CMD20_WR_OFS_DATA, input, input2, false); }
-#pragma endregion
-
-#pragma region CMDx0
-void CH376::execx0(uint8_t CMDx0, uint8_t input[], int num, bool endTransfer) {
-	spiBeginTransfer();
-	spiWrite(CMDx0);
-	for (int i = 0; i < num; i++) { spiWrite(input[i]); }
-	if (endTransfer) { spiEndTransfer(); }
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMDx0, HEX);
-	for (int i = 0; i < num; i++) {
-		Serial.println();
-		Serial.print("input");
-		Serial.print(i);
-		Serial.print(":");
-		Serial.print("\t 0x");
-		Serial.print(input[i], HEX);
+bool CH376::intPending() {
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	if (_port.pollInterrupt()) return _intLatched || pollStatus();
+#endif
+	return (_isrSlot >= 0) ? _intFlag : _port.intActive();
+}
+uint8_t CH376::takeInterrupt() {
+	uint8_t tmpRet;
+	if (_isrSlot >= 0 || _intLatched) {
+		noInterrupts();
+		bool latched = _intLatched;
+		tmpRet = _intStatus;
+		_intFlag = false;
+		_intLatched = false;
+		interrupts();
+		if (latched) return tmpRet; // the ISR/status poll has already read GET_STATUS
 	}
-	Serial.println();
-#endif // DEBUG
-}
-
-void CH376::setUSBID(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4) { 
-	uint8_t inputs[4] = { input, input2, input3, input4 };
-	execx0(CMD40_SET_USB_ID, inputs, 4);
-}
-void CH376::setFileSize(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5) {
-	uint8_t inputs[5] = { input, input2, input3, input4, input5};
-	execx0(CMD50_SET_FILE_SIZE, inputs, 5); 
-}
-void CH376::writeVAR32(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5) {
-	uint8_t inputs[5] = { input, input2, input3, input4, input5};
-	execx0(CMD50_WRITE_VAR32, inputs, 5); 
-}
-#pragma endregion
-
-#pragma region CMD01
-uint8_t CH376::exec01(uint8_t CMD01, bool endTransfer) {
-	uint8_t tmpRet = 0;
-	spiBeginTransfer();
-	spiWrite(CMD01);
-	tmpRet = spiRead();
-	if (endTransfer) { spiEndTransfer(); }
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD01, HEX);
-	Serial.println();
-	Serial.print("Returned:");
-	Serial.print("\t 0x");
-	Serial.print(tmpRet, HEX);
-	Serial.println();
-#endif // DEBUG
-	return tmpRet;
-}
-
-uint8_t CH376::delay100US() { return exec01(CMD01_DELAY_100US); }
-uint8_t CH376::getICVersion() { return exec01(CMD01_GET_IC_VER); }
-uint8_t CH376::getInterrupt() { return exec01(CMD01_GET_STATUS); }
-uint8_t CH376::readUSBData() { return exec01(CMD01_RD_USB_DATA, false); }
-uint8_t CH376::readUSBData0() { return exec01(CMD01_RD_USB_DATA0, false); }
-uint8_t CH376::testConnect() { return exec01(CMD01_TEST_CONNECT); }
-uint8_t CH376::writeRequestedData() { return exec01(CMD01_WR_REQ_DATA, false); }
-#pragma endregion
-
-#pragma region CMD11
-uint8_t CH376::exec11(uint8_t CMD11, uint8_t input, bool endTransfer) {
-	uint8_t tmpRet = 0;
-	spiBeginTransfer();
-	spiWrite(CMD11);
-	spiWrite(input);
-	tmpRet = spiRead();
-	if (endTransfer) { spiEndTransfer(); }
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD11, HEX);
-	Serial.println();
-	Serial.print("Returned:");
-	Serial.print("\t 0x");
-	Serial.print(tmpRet, HEX);
-	Serial.println();
-#endif // DEBUG
-	return tmpRet;
-}
-
-uint8_t CH376::CheckExist(uint8_t input) { return exec11(CMD11_CHECK_EXIST, input); }
-USB_SPEED CH376::getDevRate(uint8_t input) { return (USB_SPEED)exec11(CMD11_GET_DEV_RATE, input); }
-uint8_t CH376::getToggle(uint8_t input) { return exec11(CMD11_GET_TOGGLE, input); }
-uint8_t CH376::readVar8(uint8_t input) { return exec11(CMD11_READ_VAR8, input); }
-uint8_t CH376::setUSBMode(uint8_t input) {
-	return exec11(CMD11_SET_USB_MODE, input);
-	delayMicroseconds(40);
+	return getInterrupt();
 }
-#pragma endregion
-
-#pragma region CMD21
-uint8_t CH376::exec21(uint8_t CMD21, uint8_t input, uint8_t input2, bool endTransfer) {
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+bool CH376::pollStatus() { // one short bus window: the chip answers CHECK_EXIST only when it is idle again
+	uint32_t start = micros();
 	uint8_t tmpRet = 0;
-	spiBeginTransfer();
-	spiWrite(CMD21);
-	spiWrite(input);
-	spiWrite(input2);
-	tmpRet = spiRead();
-	if (endTransfer) { spiEndTransfer(); }
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD21, HEX);
-	Serial.println();
-	Serial.print("input:");
-	Serial.print("\t 0x");
-	Serial.print(input, HEX);
-	Serial.println();
-	Serial.print("input2:");
-	Serial.print("\t 0x");
-	Serial.print(input2, HEX);
-	Serial.println();
-	Serial.print("Returned:");
-	Serial.print("\t 0x");
-	Serial.print(tmpRet, HEX);
-	Serial.println();
-#endif // DEBUG
-	return 	tmpRet;
+	bool done;
+	_port.beginTransfer();
+	_port.command(CMD11_CHECK_EXIST);
+	_port.write(0x55);
+	done = (_port.read() == 0xAA);
+	if (done) {
+		_port.nextCommand();
+		_port.command(CMD01_GET_STATUS);
+		tmpRet = _port.read();
+		_port.nextCommand();
+		_port.command(CMD11_READ_VAR8);
+		_port.write(VAR_DISK_STATUS);
+		uint8_t tmpDisk = (_port.read() >= DEF_DISK_CONNECT) ? USB_INT_CONNECT : USB_INT_DISCONNECT;
+		if (!_pollFirst) { // no command waits: GET_STATUS repeats the last completion, the disk state tells a real connect/disconnect
+			done = (tmpDisk != _pollLast);
+			tmpRet = tmpDisk;
+		}
+		_pollLast = tmpDisk; // re-synced at every command completion
+	}
+	if (done && _batching) _batchHeld = true; // runRead(): the data block follows in the same transfer
+	else _port.endTransfer();
+	_pollBusTime += micros() - start;
+	_pollCount++;
+	if (done) {
+		_intStatus = tmpRet;
+		_intLatched = true;
+	}
+	return done;
+}
+void CH376::negotiateClock() { // double the clock while the link holds, keep one step below the first failure
+	uint32_t good = _port.clock();
+	_clockMin = good;
+	while (good < _clockMax) {
+		_port.setClock(SPIClock{min(good * 2, _clockMax)});
+		if (!linkCheck(true)) {
+			good = max(good / 2, _clockMin); // margin: the last passing step may be marginal on a long cable
+			break;
+		}
+		good = _port.clock();
+	}
+	_port.setClock(SPIClock{good});
+}
+bool CH376::linkCheck(bool loopback) { // CHECK_EXIST echo burst, at init also a loopback through a 32 bit chip variable
+	static const uint8_t patterns[] = { 0x55, 0xAA, 0x00, 0xFF, 0x5A, 0xA5, 0x0F, 0xF0 };
+	static const uint32_t words[] = { 0xA55A0FF0, 0x5AA5F00F, 0x00000000, 0xFFFFFFFF };
+	uint8_t tmpRet[4];
+	bool tmpPass = true;
+	_clockCheck = true;
+	for (uint8_t i = 0; i < sizeof(patterns) && tmpPass; i++) {
+		tmpPass = pingDevice(patterns[i]);
+	}
+	for (uint8_t i = 0; i < 4 && tmpPass && loopback; i++) { // no file is open yet, VAR_CURRENT_OFFSET is free
+		run<CmdWriteVar32>(VAR_CURRENT_OFFSET, words[i], words[i] >> 8, words[i] >> 16, words[i] >> 24);
+		tmpRet[0] = run<CmdReadVar32>(VAR_CURRENT_OFFSET);
+		portReadMultiple(&tmpRet[1], 3);
+		portEndTransfer();
+		tmpPass = (tmpRet[0] | (uint32_t)tmpRet[1] << 8 | (uint32_t)tmpRet[2] << 16 | (uint32_t)tmpRet[3] << 24) == words[i];
+	}
+	_clockCheck = false;
+	return tmpPass;
+}
+uint16_t CH376::pollDelay(uint8_t command) { // first backoff step per command class, up to 32 times as long later
+	switch (command) {
+	case CMD0H_BYTE_RD_GO:
+	case CMD0H_BYTE_WR_GO:
+	case CMD0H_DISK_RD_GO:
+	case CMD0H_DISK_WR_GO:
+	case CMD2H_BYTE_READ:
+	case CMD2H_BYTE_WRITE:
+	case CMD4H_BYTE_LOCATE:
+		return 16; // mostly served from the chip's sector buffer
+	case CMD0H_DISK_MOUNT:
+	case CMD0H_DISK_CONNECT:
+	case CMD0H_FILE_CREATE:
+	case CMD0H_FILE_ERASE:
+	case CMD0H_DIR_CREATE:
+	case CMD0H_DISK_QUERY:
+		return 500; // FAT scans and allocation, up to hundreds of ms
+	default:
+		return 100;
+	}
 }
-
-uint8_t CH376::setBaudrate(uint8_t input, uint8_t input2) { return exec21(CMD21_SET_BAUDRATE, input, input2); }
+#endif
 #pragma endregion
 
-#pragma region CMD0H
-uint8_t CH376::exec0H(uint8_t CMD0H, bool endTransfer) {
-	uint8_t tmpRet = 0;
-	spiBeginTransfer();
-	spiWrite(CMD0H);
-	spiEndTransfer();
-	tmpRet = waitInterrupt(endTransfer);
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD0H, HEX);
-	Serial.println();
-	Serial.print("Returned:");
-	Serial.print("\t 0x");
-	Serial.print(tmpRet, HEX);
-	Serial.println();
-#endif // DEBUG
-	return tmpRet;
-}
+#pragma region Async
+CH376* CH376::_isrOwner[CH376_INT_SLOTS];
 
-uint8_t CH376::autoSetup() { return exec0H(CMD0H_AUTO_SETUP); }
-uint8_t CH376::byteReadGo() {
-	uint8_t tmpRet = exec0H(CMD0H_BYTE_RD_GO);
+template <uint8_t N> void CH376::isrSlot() { _isrOwner[N]->handleInt(); }
 
-	if (tmpRet != USB_INT_DISK_READ && tmpRet != USB_INT_SUCCESS) {
-		setError(tmpRet);
+void CH376::handleInt() {
+	if (CH376Port::latchInISR) { // latch the status now, this also releases the INT line
+		_port.beginTransfer();
+		_port.command(CMD01_GET_STATUS);
+		_intStatus = _port.read();
+		_port.endTransfer();
+		_intLatched = true;
 	}
-	return tmpRet;
+	_intFlag = true;
 }
-uint8_t CH376::byteWriteGo() {
-	uint8_t tmpRet = exec0H(CMD0H_BYTE_WR_GO);
 
-	if (tmpRet != USB_INT_DISK_WRITE && tmpRet != USB_INT_SUCCESS) {
-		setError(tmpRet);
+bool CH376::setAsyncMode(bool enable) {
+	static void (*const isrSlots[CH376_INT_SLOTS])() = { isrSlot<0>
+#if CH376_INT_SLOTS > 1
+		, isrSlot<1>
+#endif
+#if CH376_INT_SLOTS > 2
+		, isrSlot<2>
+#endif
+#if CH376_INT_SLOTS > 3
+		, isrSlot<3>
+#endif
+	};
+	commandStatus();
+	if (_isrSlot >= 0) { // release the previous slot
+		_port.detachInt();
+		_isrOwner[_isrSlot] = NULL;
+		_isrSlot = -1;
 	}
-	return tmpRet;
-}
-uint8_t CH376::dirCreate() { return exec0H(CMD0H_DIR_CREATE); }
-uint8_t CH376::dirInfoSave() { return exec0H(CMD0H_DIR_INFO_SAVE); }
-uint8_t CH376::diskBulgOnly(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_DISK_BOC_CMD);
-
-	if (tmpRet == USB_INT_SUCCESS) {
-		if (fillStruct) {
-			uint8_t tempDiskBocCbw[sizeof(BULK_ONLY_CBW)];
-			uint8_t dataLength = readUSBData0();
-
-			if (dataLength > sizeof(tempDiskBocCbw)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tempDiskBocCbw, dataLength);
-				spiEndTransfer();
-				memcpy(&DiskBocCbw, &tempDiskBocCbw, dataLength);
+	_asyncMode = enable;
+	if (!enable) return false;
+	for (uint8_t i = 0; i < CH376_INT_SLOTS; i++) {
+		if (_isrOwner[i] == NULL) {
+			_intFlag = false;
+			_intLatched = false;
+			_isrOwner[i] = this;
+			if (_port.attachInt(isrSlots[i])) {
+				_isrSlot = i;
+				return true;
 			}
+			_isrOwner[i] = NULL;
+			break;
 		}
 	}
-	else { setError(tmpRet); }
-
-	return tmpRet;
+	return false; // no ISR, completion is polled on the INT line/status port
 }
-uint8_t CH376::diskCapacity() { return exec0H(CMD0H_DISK_CAPACITY); }
-uint8_t CH376::diskConnect() { return exec0H(CMD0H_DISK_CONNECT); }
-uint8_t CH376::diskInit(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_DISK_INIT);
-
-	if (tmpRet == USB_INT_SUCCESS) {
-		if (fillStruct) {
-			uint8_t tempDiskInitInq[sizeof (INQUIRY_DATA)];
-			uint8_t dataLength = readUSBData0();
-
-			if (dataLength > sizeof(tempDiskInitInq)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tempDiskInitInq, dataLength);
-				spiEndTransfer();
-				memcpy(&DiskInitInq, &tempDiskInitInq, dataLength);
-			}
-		}
-	}
-	else { setError(tmpRet); }
 
-	return tmpRet;
+void CH376::startCommand(uint8_t CMDxH, const uint8_t input[], uint8_t num) {
+	portBeginTransfer();
+#ifdef CH376_TRACING
+	_traceStart = micros();
+	_traceCmd = CMDxH;
+	_traceNum = num;
+	if (num) memcpy(_traceIn, input, min(num, (uint8_t)sizeof(_traceIn)));
+#endif
+	portCommand(CMDxH);
+	if (num) portWriteMultiple(input, num);
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	_pollFirst = pollDelay(CMDxH);
+#endif
+	_batching = false; // the interrupt command closes the batch
+	_batchHeld = false;
+	portEndTransfer();
+	_deferOk = 0;
+	_deferOk2 = 0;
+	_cmdPending = true;
 }
-uint8_t CH376::diskInquiry(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_DISK_INQUIRY);
 
-	if (tmpRet == USB_INT_SUCCESS) {
-		if (fillStruct) {
-			uint8_t tempDiskInqData[sizeof (INQUIRY_DATA)];
-			uint8_t dataLength = readUSBData0();
-
-			if (dataLength > sizeof(tempDiskInqData)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tempDiskInqData, dataLength);
-				spiEndTransfer();
-				memcpy(&DiskInqData, &tempDiskInqData, dataLength);
-			}
-		}
-	}
-	else { setError(tmpRet); }
-	return tmpRet;
+void CH376::deferCommand(uint8_t CMDxH, uint8_t okStatus, uint8_t okStatus2, const uint8_t input[], uint8_t num) {
+	startCommand(CMDxH, input, num);
+	_deferOk = okStatus;
+	_deferOk2 = okStatus2;
 }
-uint8_t CH376::diskMaxLogicalUnitNumber() { return exec0H(CMD0H_DISK_MAX_LUN); }
-uint8_t CH376::diskMount(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_DISK_MOUNT);
 
-	if (tmpRet == USB_INT_SUCCESS) {
-		if (fillStruct) {
-			uint8_t tempDiskMountInq[sizeof(INQUIRY_DATA)];
-			uint8_t dataLength = readUSBData0();
+void CH376::beginBatch() {
+	_batching = true;
+}
 
-			if (dataLength > sizeof(tempDiskMountInq)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tempDiskMountInq, dataLength);
-				spiEndTransfer();
-				memcpy(&DiskMountInq, &tempDiskMountInq, dataLength);
-			}
-		}
+void CH376::endBatch() {
+	_batching = false;
+	if (_batchHeld) {
+		_batchHeld = false;
+		_port.endTransfer();
 	}
-	else { setError(tmpRet); }
-	return tmpRet;
 }
-uint8_t CH376::diskQuery(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_DISK_QUERY);
 
-	if (tmpRet == USB_INT_DISK_READ) {
-		if (fillStruct) {
-			uint8_t tmpDiskQueryInfo[sizeof(DiskQuery)];
-			uint8_t dataLength = readUSBData0();
+bool CH376::commandDone() {
+	return !_cmdPending || intPending();
+}
 
-			if (dataLength > sizeof(tmpDiskQueryInfo)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tmpDiskQueryInfo, dataLength);
-				spiEndTransfer();
-				memcpy(&DiskQueryInfo, &tmpDiskQueryInfo, dataLength);
-			}
-		}
+uint8_t CH376::commandStatus() {
+	uint8_t tmpRet;
+	if (!_cmdPending) return 0x00;
+	_cmdPending = false;
+	tmpRet = waitInterrupt();
+#ifdef CH376_TRACING
+	traceCommand(_traceCmd, _traceIn, _traceNum, tmpRet, true, _traceStart);
+#endif
+	if (_deferOk && tmpRet != _deferOk && tmpRet != _deferOk2) {
+		setError(tmpRet); // nobody waits for a deferred command, report it here
 	}
-	else { setError(tmpRet); }
+	_deferOk = 0;
 	return tmpRet;
 }
-uint8_t CH376::diskReadGo() { return exec0H(CMD0H_DISK_RD_GO); }
-uint8_t CH376::diskReady() { return exec0H(CMD0H_DISK_READY); }
-uint8_t CH376::diskReset() { return exec0H(CMD0H_DISK_RESET); }
-uint8_t CH376::diskCheckErrors(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_DISK_R_SENSE);
-
-	if (tmpRet == USB_INT_SUCCESS) {
-		if (fillStruct) {
-			uint8_t tempReqSenseData[sizeof (SENSE_DATA)];
-			uint8_t dataLength = readUSBData0();
+#pragma endregion
 
-			if (dataLength > sizeof(tempReqSenseData)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tempReqSenseData, dataLength);
-				spiEndTransfer();
-				memcpy(&ReqSenseData, &tempReqSenseData, dataLength);
-			}
-		}
+#pragma region Trace
+#ifdef CH376_TRACING
+void CH376::traceCommand(uint8_t command, const uint8_t input[], uint8_t num, uint8_t status, bool hasStatus, uint32_t start) {
+	uint32_t elapsed = micros() - start;
+	uint8_t kept = min(num, (uint8_t)5);
+#if CH376_TRACE_RING > 0
+	CH376Trace& entry = _trace[_traceHead];
+	entry.command = command;
+	if (kept) memcpy(entry.input, input, kept);
+	entry.num = num;
+	entry.status = status;
+	entry.hasStatus = hasStatus;
+	entry.elapsed = elapsed;
+	if (++_traceHead == CH376_TRACE_RING) _traceHead = 0;
+	if (_traceCount < CH376_TRACE_RING) _traceCount++;
+#endif
+#if CH376_TRACE_LEVEL >= CH376_TRACE_COMMANDS
+	CH376_TRACE_PORT.print(F("CMD 0x"));
+	CH376_TRACE_PORT.print(command, HEX);
+	for (uint8_t i = 0; i < kept; i++) {
+		CH376_TRACE_PORT.print(F(" 0x"));
+		CH376_TRACE_PORT.print(input[i], HEX);
 	}
-	else { setError(tmpRet); }
-	return tmpRet;
-}
-uint8_t CH376::diskSize() {
-		return exec0H(CMD0H_DISK_SIZE);
+	if (hasStatus) {
+		CH376_TRACE_PORT.print(F(" -> 0x"));
+		CH376_TRACE_PORT.print(status, HEX);
+	}
+	CH376_TRACE_PORT.print('\t');
+	CH376_TRACE_PORT.print(elapsed);
+	CH376_TRACE_PORT.println(F("us"));
+#else
+	(void)kept;
+#endif
 }
-uint8_t CH376::diskWriteGo() { return exec0H(CMD0H_DISK_WR_GO); }
-uint8_t CH376::fileCreate() { return exec0H(CMD0H_FILE_CREATE); }
-uint8_t CH376::fileEnumGo(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_FILE_ENUM_GO);
-
-	if (tmpRet == USB_INT_DISK_READ) {
-		if (fillStruct) {
-			uint8_t tempEnumDirInfo[sizeof(FAT_DIR_INFO)];
-			uint8_t dataLength = readUSBData0();
+#endif
 
-			if (dataLength > sizeof(tempEnumDirInfo)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tempEnumDirInfo, dataLength);
-				spiEndTransfer();
-				memcpy(&EnumDirInfo, &tempEnumDirInfo, dataLength);
-			}
-		}
+#if CH376_TRACE_LEVEL >= CH376_TRACE_DATA
+void CH376::traceData(const char dir[], const uint8_t* buffer, uint16_t b_size) {
+	CH376_TRACE_PORT.print(dir);
+	for (uint16_t i = 0; i < b_size; i++) {
+		CH376_TRACE_PORT.print(buffer[i] < 0x10 ? F(" 0") : F(" "));
+		CH376_TRACE_PORT.print(buffer[i], HEX);
 	}
-	else { setError(tmpRet); }
-	return tmpRet;
+	CH376_TRACE_PORT.println();
 }
-uint8_t CH376::fileErase() { return exec0H(CMD0H_FILE_ERASE); }
-uint8_t CH376::fileOpen(bool fillStruct) {
-	uint8_t tmpRet = exec0H(CMD0H_FILE_OPEN);
-
-	if (tmpRet == USB_INT_SUCCESS) {
-		if (fillStruct) {
-			uint8_t tempOpenDirInfo[sizeof(FAT_DIR_INFO)];
-			uint8_t dataLength = readUSBData0();
+#endif
 
-			if (dataLength > sizeof(tempOpenDirInfo)) {
-				setError(ERR_OVERFLOW);
-			}
-			else {
-				spiReadMultiple(tempOpenDirInfo, dataLength);
-				spiEndTransfer();
-				memcpy(&OpenDirInfo, &tempOpenDirInfo, dataLength);
-			}
+#if CH376_TRACE_RING > 0
+uint8_t CH376::getTraceCount() { return _traceCount; }
+const CH376Trace& CH376::getTrace(uint8_t index) {
+	uint8_t pos = (_traceHead + CH376_TRACE_RING - _traceCount + index) % CH376_TRACE_RING;
+	return _trace[pos];
+}
+void CH376::clearTrace() {
+	_traceHead = 0;
+	_traceCount = 0;
+}
+void CH376::dumpTrace(Print& out) {
+	for (uint8_t i = 0; i < _traceCount; i++) {
+		const CH376Trace& entry = getTrace(i);
+		out.print(F("0x"));
+		out.print(entry.command, HEX);
+		for (uint8_t j = 0; j < min(entry.num, (uint8_t)5); j++) {
+			out.print(F(" 0x"));
+			out.print(entry.input[j], HEX);
+		}
+		if (entry.hasStatus) {
+			out.print(F(" -> 0x"));
+			out.print(entry.status, HEX);
 		}
+		out.print('\t');
+		out.print(entry.elapsed);
+		out.println(F("us"));
 	}
-	else { setError(tmpRet); }
-	return tmpRet;
-}
-uint8_t CH376::readDiskSector() { return exec0H(CMD0H_RD_DISK_SEC); }
-uint8_t CH376::writeDiskSector() { return exec0H(CMD0H_WR_DISK_SEC); }
-#pragma endregion
-
-#pragma region CMD1H
-uint8_t CH376::exec1H(uint8_t CMD1H, uint8_t input, bool endTransfer) {
-	uint8_t tmpRet = 0;
-	spiBeginTransfer();
-	spiWrite(CMD1H);
-	spiWrite(input);
-	spiEndTransfer();
-	tmpRet = waitInterrupt(endTransfer);
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD1H, HEX);
-	Serial.println();
-	Serial.print("Returned:");
-	Serial.print("\t 0x");
-	Serial.print(tmpRet, HEX);
-	Serial.println();
-#endif // DEBUG
-	return tmpRet;
 }
-
-uint8_t CH376::clearEndPointError(uint8_t input) { return exec1H(CMD1H_CLR_STALL, input); }
-uint8_t CH376::dirInfoRead(uint8_t input) { return exec1H(CMD1H_DIR_INFO_READ, input); }
-uint8_t CH376::fileClose(uint8_t input) { return exec1H(CMD1H_FILE_CLOSE, input); }
-uint8_t CH376::getDescription(uint8_t input) { return exec1H(CMD1H_GET_DESCR, input); }
-uint8_t CH376::issueToken(uint8_t input) { return exec1H(CMD1H_ISSUE_TOKEN, input); }
-uint8_t CH376::readFromSector(uint8_t input) { return exec1H(CMD1H_SEC_READ, input); }
-uint8_t CH376::writeToSector(uint8_t input) { return exec1H(CMD1H_SEC_WRITE, input); }
-uint8_t CH376::setAddress(uint8_t input) { return exec1H(CMD1H_SET_ADDRESS, input); }
-uint8_t CH376::setConfig(uint8_t input) { return exec1H(CMD1H_SET_CONFIG, input); }
+#endif
 #pragma endregion
 
-#pragma region CMD2H
-uint8_t CH376::exec2H(uint8_t CMD2H, uint8_t input, uint8_t input2, bool endTransfer) {
+#pragma region Commands
+uint8_t CH376::execute(uint8_t command, const uint8_t input[], uint8_t num, uint8_t flags, uint8_t okStatus, uint8_t okStatus2) {
 	uint8_t tmpRet = 0;
-	spiBeginTransfer();
-	spiWrite(CMD2H);
-	spiWrite(input);
-	spiWrite(input2);
-	spiEndTransfer();
-	tmpRet = waitInterrupt(endTransfer);
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMD2H, HEX);
-	Serial.println();
-	Serial.print("input:");
-	Serial.print("\t 0x");
-	Serial.print(input, HEX);
-	Serial.println();
-	Serial.print("input2:");
-	Serial.print("\t 0x");
-	Serial.print(input2, HEX);
-	Serial.println();
-	Serial.print("Returned:");
-	Serial.print("\t 0x");
-	Serial.print(tmpRet, HEX);
-	Serial.println();
-#endif // DEBUG
-	return 	tmpRet;
-}
-
-uint8_t CH376::readByte(uint8_t input, uint8_t input2) {
-	uint8_t tmpRet = exec2H(CMD2H_BYTE_READ, input, input2);
-
-	if (tmpRet != USB_INT_SUCCESS && tmpRet != USB_INT_DISK_READ) {
-		setError(tmpRet);
+	if (flags & CMDF_INT) {
+		startCommand(command, input, num);
+		tmpRet = commandStatus();
 	}
-	return tmpRet;
-}
-uint8_t CH376::writeByte(uint8_t input, uint8_t input2) {
-	uint8_t tmpRet = exec2H(CMD2H_BYTE_WRITE, input, input2);
-
-	if (tmpRet != USB_INT_SUCCESS && tmpRet != USB_INT_DISK_WRITE) {
-		setError(tmpRet);
+	else {
+#ifdef CH376_TRACING
+		uint32_t traceStart = micros();
+#endif
+		portBeginTransfer();
+		portCommand(command);
+		if (num) portWriteMultiple(input, num);
+		if (flags & CMDF_OUT) tmpRet = portRead();
+		if (!(flags & CMDF_DATA)) portEndTransfer(); // else the data phase follows in the same transfer
+#ifdef CH376_TRACING
+		traceCommand(command, input, num, tmpRet, flags & CMDF_OUT, traceStart);
+#endif
 	}
-	return tmpRet;
+	return checkStatus(tmpRet, okStatus, okStatus2);
 }
-uint8_t CH376::issueToken(uint8_t input, uint8_t input2) { return exec2H(CMD2H_ISSUE_TKN_X, input, input2); }
-#pragma endregion
 
-#pragma region CMDxH
-uint8_t CH376::execxH(uint8_t CMDxH, uint8_t input[], int num, bool endTransfer) {
-	uint8_t tmpRet = 0;
-	spiBeginTransfer();
-	spiWrite(CMDxH);
-	for (int i = 0; i < num; i++) { spiWrite(input[i]); }
-	spiEndTransfer();
-	tmpRet = waitInterrupt(endTransfer);
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Command:");
-	Serial.print("\t 0x");
-	Serial.print(CMDxH, HEX);
-	for (int i = 0; i < num; i++) {
-		Serial.println();
-		Serial.print("input");
-		Serial.print(i);
-		Serial.print(":");
-		Serial.print("\t 0x");
-		Serial.print(input[i], HEX);
+uint8_t CH376::checkStatus(uint8_t status, uint8_t okStatus, uint8_t okStatus2) {
+	if (okStatus && status != okStatus && status != okStatus2) {
+		setError(status);
 	}
-	Serial.println();
-	Serial.print("Returned:");
-	Serial.print("\t 0x");
-	Serial.print(tmpRet, HEX);
-	Serial.println();
-#endif // DEBUG
-	return 	tmpRet;
+	return status;
 }
 
-uint8_t CH376::movePointer(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4) {
-	uint8_t inputs[4] = { input, input2, input3, input4 };
-	return execxH(CMD4H_BYTE_LOCATE, inputs, 4);
-}
-uint8_t CH376::moveSectorPointer(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4) {
-	uint8_t inputs[4] = { input, input2, input3, input4 };
-	return execxH(CMD4H_SEC_LOCATE, inputs, 4); 
+void CH376::setFileName(const char* filename) {
+	portBeginTransfer();
+	portCommand(CMD10_SET_FILE_NAME);
+	//write(0x2f); // "/" root directory
+	portPrint(filename); // filename
+	//write(0x5C);	// this is the "\" sign 
+	portWrite((uint8_t)0x00);	// terminating null character
+	portEndTransfer();
 }
-uint8_t CH376::diskRead(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5) {
-	uint8_t inputs[4] = { input, input2, input3, input4 };
-	return execxH(CMD5H_DISK_READ, inputs, 5); 
+uint8_t CH376::getInterrupt() {
+	if (CH376Port::pushesStatus) return portRead(); // serial mode: the status byte is already on its way
+	return run<CmdGetStatus>();
 }
-uint8_t CH376::diskWrite(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5) {
-	uint8_t inputs[4] = { input, input2, input3, input4 };
-	return execxH(CMD5H_DISK_WRITE, inputs, 5); 
+uint8_t CH376::readUSBData0(uint8_t* buffer, uint8_t b_size) { // stream the data block straight to the destination
+	uint8_t dataLength = run<CmdReadUSBData0>();
+
+	if (dataLength > b_size) {
+		portEndTransfer();
+		setError(ERR_OVERFLOW);
+		return 0;
+	}
+	portReadMultiple(buffer, dataLength);
+	portEndTransfer();
+	return dataLength;
 }
 #pragma endregion
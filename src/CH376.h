@@ -20,12 +20,18 @@
  *
  */
 
+#ifndef CH376_H
+#define CH376_H
+
+#include "CH376Config.h"
+#if CH376_TRANSPORT != CH376_TRANSPORT_LINUX
 #include <Arduino.h>
 #include <Stream.h>
 #include <SPI.h>
+#endif
 #include "CH376DEF.h"
-
-#define DEBUG
+#include "CH376Port.h"
+#include "CH376Cmd.h"
 
 #if defined(__STM32F1__)
 #include "itoa.h"
@@ -35,141 +41,139 @@
 #include "avr/dtostrf.h"
 #endif
 
-#define SPI_SCK_KHZ(speedKhz) SPISettings(1000UL * speedKhz, MSBFIRST, SPI_MODE0) //get the speed in KHz
-#define SPI_SCK_MHZ(speedMhz) SPISettings(1000000UL * speedMhz, MSBFIRST, SPI_MODE0) //get the speed in MHz
+static_assert(sizeof(FAT_DIR_INFO) == 32, "FAT_DIR_INFO must keep the layout of a FAT directory entry");
+
+struct CH376Trace { // one command in the trace ring
+	uint8_t command;
+	uint8_t input[5];
+	uint8_t num; // number of input bytes, only the first 5 are kept
+	uint8_t status; // returned status/interrupt
+	bool hasStatus; // false for commands without an output
+	uint32_t elapsed; // us from the command byte until the status was taken
+};
 
 class CH376 {
 public:
-	CH376(uint8_t spiSelect, uint8_t intPin, SPISettings speed = SPI_SCK_KHZ(125));
-	CH376(uint8_t spiSelect, SPISettings speed = SPI_SCK_KHZ(125));
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+	CH376(CH376SerialType& serialPort, uint32_t speed = BaudRate9600);
+#elif CH376_TRANSPORT == CH376_TRANSPORT_PARALLEL
+	CH376(const uint8_t dataPins[8], uint8_t a0Pin, uint8_t wrPin, uint8_t rdPin, uint8_t csPin);
+#elif CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+	CH376(CH376LinuxHAL& hal);
+#else
+	CH376(uint8_t spiSelect, uint8_t intPin, SPIClock speed = SPI_SCK_KHZ(125));
+	CH376(uint8_t spiSelect, SPIClock speed = SPI_SCK_KHZ(125));
+	CH376(SPIClass& spiBus, uint8_t spiSelect, uint8_t intPin, SPIClock speed = SPI_SCK_KHZ(125));
+	CH376(SPIClass& spiBus, uint8_t spiSelect, SPIClock speed = SPI_SCK_KHZ(125));
+#endif
 	virtual ~CH376();
 
 	void init();
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	bool setSPIPins(uint8_t sckPin, uint8_t misoPin, uint8_t mosiPin); // call before init(), false if the core has fixed SPI pins
+	void setAutoClock(SPIClock maxSpeed = SPI_SCK_MHZ(8)); // call before init(): raise the clock from the constructor speed up to maxSpeed
+	uint32_t getSPIClock(); // Hz in use
+	uint32_t getPollBusTime(); // SPI_INT_POLL: us the bus was held by status polls
+	uint32_t getPollCount();
+	void resetPollStats();
+#endif
 	bool pingDevice(byte value = 0x01);
 	bool getDeviceAttached();
 	bool getControllerReady();
 	bool setMode(USB_MODE mode = MODE_HOST_0);
 	void setSpeed(USB_SPEED speed);
 	uint8_t getError();
+	bool setAsyncMode(bool enable = true); // returns true if the INT pin is served by an ISR
+	bool commandDone();
+	uint8_t commandStatus();
+	void beginBatch(); // send the next commands back to back, up to and including the next interrupt command
+	void endBatch();
+#if CH376_TRACE_RING > 0
+	void dumpTrace(Print& out); // oldest command first
+	void clearTrace();
+	uint8_t getTraceCount();
+	const CH376Trace& getTrace(uint8_t index); // 0 = oldest
+#endif
 protected:
-	uint8_t waitInterrupt(bool endTransfer = true);
+	uint8_t waitInterrupt();
+	bool intPending();
+	uint8_t takeInterrupt();
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	bool pollStatus();
+	static uint16_t pollDelay(uint8_t command);
+	void negotiateClock();
+	bool linkCheck(bool loopback);
+#endif
+	void startCommand(uint8_t CMDxH, const uint8_t input[] = NULL, uint8_t num = 0);
+	void deferCommand(uint8_t CMDxH, uint8_t okStatus, uint8_t okStatus2, const uint8_t input[] = NULL, uint8_t num = 0);
+	void handleInt();
+	template <uint8_t N> static void isrSlot();
 	void setError(uint8_t errCode);
 	void clearError();
+#ifdef CH376_TRACING
+	void traceCommand(uint8_t command, const uint8_t input[], uint8_t num, uint8_t status, bool hasStatus, uint32_t start);
+#endif
+#if CH376_TRACE_LEVEL >= CH376_TRACE_DATA
+	void traceData(const char dir[], const uint8_t* buffer, uint16_t b_size);
+#endif
+
+	void portBeginTransfer();
+	void portEndTransfer();
+	void portCommand(uint8_t command);
+	void portWrite(uint8_t data);
+	void portWriteMultiple(const uint8_t* buffer, uint16_t b_size);
+	void portPrint(const char str[]);
+	uint8_t portRead();
+	uint16_t portReadMultiple(uint8_t* buffer, uint16_t b_size);
+	void portWriteAsync(const uint8_t* buffer, uint16_t b_size);
+	void portReadAsync(uint8_t* buffer, uint16_t b_size);
+	void portWaitData();
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+	void raiseBaudrate();
+#endif
 
-	void spiBeginTransfer();
-	void spiEndTransfer();
-	void spiWrite(uint8_t data);
-	void spiPrint(const char str[]);
-	uint8_t spiRead();
-	uint8_t spiReadMultiple(uint8_t* buffer, uint8_t b_size);
-
-	void exec00(uint8_t CMD00);
-	void abortNAK();
-	void dirtyBuffer();
-	void enterSleep();
-	void resetAll();
-	void unlockUSB();
-
-	void exec10(uint8_t CMD10, uint8_t input, bool endTransfer = true);
-	void setENDPoint2(uint8_t input);
-	void setENDPoint3(uint8_t input);
-	void setENDPoint4(uint8_t input);
-	void setENDPoint5(uint8_t input);
-	void setENDPoint6(uint8_t input);
-	void setENDPoint7(uint8_t input);
-	void setFileName(uint8_t input);
+	template <class Cmd, typename... Args> uint8_t run(Args... args); // one command from the table in CH376Cmd.h
+	template <class Cmd, class T, typename... Args> uint8_t runRead(T& dest, Args... args); // and its result block
+	template <class Cmd, typename... Args> void defer(Args... args); // start an interrupt command, check its status later
+	uint8_t execute(uint8_t command, const uint8_t input[], uint8_t num, uint8_t flags, uint8_t okStatus, uint8_t okStatus2);
+	uint8_t checkStatus(uint8_t status, uint8_t okStatus, uint8_t okStatus2);
 	void setFileName(const char* filename = "");
-	void setUSBAddress(uint8_t input);
-	void setUSBSpeed(uint8_t input);
-	void writeHostData(uint8_t input);
-	void writeUSBData3(uint8_t input);
-	void writeUSBData5(uint8_t input);
-	void writeUSBData7(uint8_t input);
-
-	void exec20(uint8_t CMD20, uint8_t input, uint8_t input2, bool endTransfer = true);
-	void checkSuspended(uint8_t input, uint8_t input2);
-	void setRetry(uint8_t input, uint8_t input2);
-	void setSDOINT(uint8_t input, uint8_t input2);
-	void writeVAR8(uint8_t input, uint8_t input2);
-	void writeOffsetData(uint8_t input, uint8_t input2);
-
-	void execx0(uint8_t CMDx0, uint8_t input[], int num, bool endTransfer = true);
-	void setUSBID(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4);
-	void setFileSize(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5);
-	void writeVAR32(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5);
-
-	uint8_t exec01(uint8_t CMD01, bool endTransfer = true);
-	uint8_t delay100US();
-	uint8_t getICVersion();
 	uint8_t getInterrupt();
-	uint8_t readUSBData();
-	uint8_t readUSBData0();
-	uint8_t testConnect();
-	uint8_t writeRequestedData();
-
-	uint8_t exec11(uint8_t CMD11, uint8_t input, bool endTransfer = true);
-	uint8_t CheckExist(uint8_t input);
-	USB_SPEED getDevRate(uint8_t input);
-	uint8_t getToggle(uint8_t input);
-	uint8_t readVar8(uint8_t input);
-	uint8_t setUSBMode(uint8_t input);
-
-	uint8_t exec21(uint8_t CMD21, uint8_t input, uint8_t input2, bool endTransfer = true);
-	uint8_t setBaudrate(uint8_t input, uint8_t input2);
-
-	uint8_t exec0H(uint8_t CMD0H, bool endTransfer = true);
-	uint8_t autoSetup();
-	uint8_t byteReadGo();
-	uint8_t byteWriteGo();
-	uint8_t dirCreate();
-	uint8_t dirInfoSave();
-	uint8_t diskBulgOnly(bool fillStruct = false);
-	uint8_t diskCapacity();
-	uint8_t diskConnect();
-	uint8_t diskInit(bool fillStruct = false);
-	uint8_t diskInquiry(bool fillStruct = false);
-	uint8_t diskMaxLogicalUnitNumber();
-	uint8_t diskMount(bool fillStruct = false);
-	uint8_t diskQuery(bool fillStruct = false);
-	uint8_t diskReadGo();
-	uint8_t diskReady();
-	uint8_t diskReset();
-	uint8_t diskCheckErrors(bool fillStruct = false);
-	uint8_t diskSize();
-	uint8_t diskWriteGo();
-	uint8_t fileCreate();
-	uint8_t fileEnumGo(bool fillStruct = false);
-	uint8_t fileErase();
-	uint8_t fileOpen(bool fillStruct = false);
-	uint8_t readDiskSector();
-	uint8_t writeDiskSector();
-
-	uint8_t exec1H(uint8_t CMD1H, uint8_t input, bool endTransfer = true);
-	uint8_t clearEndPointError(uint8_t input);
-	uint8_t dirInfoRead(uint8_t input);
-	uint8_t fileClose(uint8_t input);
-	uint8_t getDescription(uint8_t input);
-	uint8_t issueToken(uint8_t input);
-	uint8_t readFromSector(uint8_t input);
-	uint8_t writeToSector(uint8_t input);
-	uint8_t setAddress(uint8_t input);
-	uint8_t setConfig(uint8_t input);
-
-	uint8_t exec2H(uint8_t CMD2H, uint8_t input, uint8_t input2, bool endTransfer = true);
-	uint8_t readByte(uint8_t input, uint8_t input2 = 0x00);
-	uint8_t writeByte(uint8_t input, uint8_t input2);
-	uint8_t issueToken(uint8_t input, uint8_t input2);
-
-	uint8_t execxH(uint8_t CMDxH, uint8_t input[], int num, bool endTransfer = true);
-	uint8_t movePointer(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4);
-	uint8_t moveSectorPointer(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4);
-	uint8_t diskRead(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5);
-	uint8_t diskWrite(uint8_t input, uint8_t input2, uint8_t input3, uint8_t input4, uint8_t input5);
+	uint8_t readUSBData0(uint8_t* buffer, uint8_t b_size);
 
 ///////Internal Variables///////////////////////////////
-	SPISettings _spiSpeed;
-	uint8_t _spiChipSelect;
-	uint8_t _intPin;
+	CH376Port _port;
+	static CH376* _isrOwner[CH376_INT_SLOTS];
+	int8_t _isrSlot = -1;
+	bool _asyncMode = false; // finish BYTE_WR_GO/FILE_CLOSE in the background
+	volatile bool _intFlag = false;
+	volatile bool _intLatched = false;
+	volatile uint8_t _intStatus = 0;
+	bool _cmdPending = false;
+	uint8_t _deferOk = 0; // accepted statuses of a deferred command, 0 = checked by the caller
+	uint8_t _deferOk2 = 0;
+	bool _batching = false; // beginBatch() was called
+	bool _batchHeld = false; // the batch has claimed the bus
+#if CH376_TRANSPORT == CH376_TRANSPORT_SPI
+	uint16_t _pollFirst = 0; // us before the first status poll of the pending command, doubled after each poll, 0 = none pending
+	uint8_t _pollLast = 0; // disk state (USB_INT_CONNECT/DISCONNECT) at the last poll, unsolicited events are reported on a change
+	uint32_t _pollBusTime = 0;
+	uint32_t _pollCount = 0;
+	uint32_t _clockMin = 0; // constructor speed, the auto clock never drops below it
+	uint32_t _clockMax = 0; // 0 = fixed clock
+	bool _clockCheck = false; // linkCheck() is running
+#endif
+#ifdef CH376_TRACING
+	uint8_t _traceCmd = 0; // interrupt command waiting for its status
+	uint8_t _traceIn[5];
+	uint8_t _traceNum = 0;
+	uint32_t _traceStart = 0;
+#endif
+#if CH376_TRACE_RING > 0
+	CH376Trace _trace[CH376_TRACE_RING];
+	uint8_t _traceHead = 0; // next entry to be written
+	uint8_t _traceCount = 0;
+#endif
 
 	bool _deviceAttached = false;
 	bool _controllerReady = false;
@@ -186,3 +190,33 @@ protected:
 	INQUIRY_DATA DiskInqData;
 	SENSE_DATA ReqSenseData;
 };
+
+template <class Cmd, typename... Args> inline uint8_t CH376::run(Args... args) {
+	static_assert(sizeof...(Args) == Cmd::args, "wrong number of inputs for this CH376 command");
+	const uint8_t input[sizeof...(Args) + 1] = { static_cast<uint8_t>(args)... };
+	return execute(Cmd::op, input, Cmd::args, Cmd::flags, Cmd::ok, Cmd::ok2);
+}
+
+template <class Cmd, class T, typename... Args> inline uint8_t CH376::runRead(T& dest, Args... args) {
+	static_assert(sizeof...(Args) == Cmd::args, "wrong number of inputs for this CH376 command");
+	static_assert(Cmd::data && (Cmd::flags & CMDF_INT), "this CH376 command has no result block");
+	const uint8_t input[sizeof...(Args) + 1] = { static_cast<uint8_t>(args)... };
+	uint8_t tmpRet;
+	startCommand(Cmd::op, input, Cmd::args);
+	beginBatch(); // GET_STATUS and RD_USB_DATA0 in one transfer
+	tmpRet = commandStatus();
+	if (tmpRet == Cmd::data) {
+		readUSBData0((uint8_t*)&dest, sizeof(T));
+	}
+	endBatch();
+	return checkStatus(tmpRet, Cmd::ok, Cmd::ok2);
+}
+
+template <class Cmd, typename... Args> inline void CH376::defer(Args... args) {
+	static_assert(sizeof...(Args) == Cmd::args, "wrong number of inputs for this CH376 command");
+	static_assert(Cmd::flags & CMDF_INT, "only interrupt commands can be deferred");
+	const uint8_t input[sizeof...(Args) + 1] = { static_cast<uint8_t>(args)... };
+	deferCommand(Cmd::op, Cmd::ok, Cmd::ok2, input, Cmd::args);
+}
+
+#endif // CH376_H
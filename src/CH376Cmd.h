@@ -0,0 +1,156 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef CH376CMD_H
+#define CH376CMD_H
+
+#include <stdint.h>
+#include "CH376DEF.h"
+
+// Command descriptor table. Every command of the chip is a type carrying its properties as compile time
+// constants, CH376::run<Cmd>(args...) builds the transaction from them. A command which is never run
+// generates no code at all.
+
+/////// Flags ///////////////////////////////////////////
+#define CMDF_OUT 0x01	// the chip answers with one byte right after the inputs
+#define CMDF_INT 0x02	// the command completes with an interrupt, the status is read with GET_STATUS
+#define CMDF_DATA 0x04	// the transfer stays open for a data phase, the caller ends it
+
+template <uint8_t Op, uint8_t Args, uint8_t Flags, uint8_t Ok = 0, uint8_t Ok2 = 0, uint8_t Data = 0>
+struct CH376Command {
+	static constexpr uint8_t op = Op;			// command code
+	static constexpr uint8_t args = Args;		// number of input bytes
+	static constexpr uint8_t flags = Flags;
+	static constexpr uint8_t ok = Ok;			// accepted status, anything else goes to setError(), 0 = checked by the caller
+	static constexpr uint8_t ok2 = Ok2 ? Ok2 : Ok;
+	static constexpr uint8_t data = Data;		// status after which RD_USB_DATA0 returns the result block, 0 = none
+	static_assert(!(Flags & CMDF_INT) || !(Flags & (CMDF_OUT | CMDF_DATA)), "interrupt commands answer through GET_STATUS only");
+	static_assert(!Ok || (Flags & (CMDF_OUT | CMDF_INT)), "a status can only be checked if the command returns one");
+};
+
+/////// CMD00 ///////////////////////////////////////////
+typedef CH376Command<CMD00_ABORT_NAK, 0, 0> CmdAbortNAK;
+typedef CH376Command<CMD00_DIRTY_BUFFER, 0, 0> CmdDirtyBuffer;	// file mode re-reads its sector buffers
+typedef CH376Command<CMD00_ENTER_SLEEP, 0, 0> CmdEnterSleep;
+typedef CH376Command<CMD00_RESET_ALL, 0, 0> CmdResetAll;
+typedef CH376Command<CMD00_UNLOCK_USB, 0, 0> CmdUnlockUSB;
+
+/////// CMD10 ///////////////////////////////////////////
+typedef CH376Command<CMD10_SET_ENDP2, 1, 0> CmdSetEndpoint2;
+typedef CH376Command<CMD10_SET_ENDP3, 1, 0> CmdSetEndpoint3;
+typedef CH376Command<CMD10_SET_ENDP4, 1, 0> CmdSetEndpoint4;
+typedef CH376Command<CMD10_SET_ENDP5, 1, 0> CmdSetEndpoint5;
+typedef CH376Command<CMD10_SET_ENDP6, 1, 0> CmdSetEndpoint6;
+typedef CH376Command<CMD10_SET_ENDP7, 1, 0> CmdSetEndpoint7;
+typedef CH376Command<CMD10_SET_FILE_NAME, 1, 0> CmdSetFileName;
+typedef CH376Command<CMD10_SET_USB_ADDR, 1, 0> CmdSetUSBAddress;
+typedef CH376Command<CMD10_SET_USB_SPEED, 1, 0> CmdSetUSBSpeed;
+typedef CH376Command<CMD10_WR_HOST_DATA, 1, CMDF_DATA> CmdWriteHostData;	// input: length, followed by the data
+typedef CH376Command<CMD10_WR_USB_DATA3, 1, CMDF_DATA> CmdWriteUSBData3;
+typedef CH376Command<CMD10_WR_USB_DATA5, 1, CMDF_DATA> CmdWriteUSBData5;
+typedef CH376Command<CMD10_WR_USB_DATA7, 1, CMDF_DATA> CmdWriteUSBData7;
+
+/////// CMD20 ///////////////////////////////////////////
+typedef CH376Command<CMD20_CHK_SUSPEND, 2, 0> CmdCheckSuspend;
+typedef CH376Command<CMD20_SET_RETRY, 2, 0> CmdSetRetry;
+typedef CH376Command<CMD20_SET_SDO_INT, 2, 0> CmdSetSDOInt;
+typedef CH376Command<CMD20_WRITE_VAR8, 2, 0> CmdWriteVar8;
+typedef CH376Command<CMD20_WR_OFS_DATA, 2, CMDF_DATA> CmdWriteOffsetData;	// input: offset, length, followed by the data
+
+/////// CMDx0 ///////////////////////////////////////////
+typedef CH376Command<CMD40_SET_USB_ID, 4, 0> CmdSetUSBID;
+typedef CH376Command<CMD50_SET_FILE_SIZE, 5, 0> CmdSetFileSize;
+typedef CH376Command<CMD50_WRITE_VAR32, 5, 0> CmdWriteVar32;
+
+/////// CMD01 ///////////////////////////////////////////
+typedef CH376Command<CMD01_DELAY_100US, 0, CMDF_OUT> CmdDelay100US;
+typedef CH376Command<CMD01_GET_IC_VER, 0, CMDF_OUT> CmdGetICVersion;
+typedef CH376Command<CMD01_GET_STATUS, 0, CMDF_OUT> CmdGetStatus;
+typedef CH376Command<CMD01_RD_USB_DATA, 0, CMDF_OUT | CMDF_DATA> CmdReadUSBData;	// output: length, followed by the data
+typedef CH376Command<CMD01_RD_USB_DATA0, 0, CMDF_OUT | CMDF_DATA> CmdReadUSBData0;
+typedef CH376Command<CMD01_TEST_CONNECT, 0, CMDF_OUT> CmdTestConnect;
+typedef CH376Command<CMD01_WR_REQ_DATA, 0, CMDF_OUT | CMDF_DATA> CmdWriteReqData;	// output: requested length, followed by the data
+
+/////// CMD11 ///////////////////////////////////////////
+typedef CH376Command<CMD11_CHECK_EXIST, 1, CMDF_OUT> CmdCheckExist;
+typedef CH376Command<CMD11_GET_DEV_RATE, 1, CMDF_OUT> CmdGetDevRate;
+typedef CH376Command<CMD11_GET_TOGGLE, 1, CMDF_OUT> CmdGetToggle;
+typedef CH376Command<CMD11_READ_VAR8, 1, CMDF_OUT> CmdReadVar8;
+typedef CH376Command<CMD11_SET_USB_MODE, 1, CMDF_OUT> CmdSetUSBMode;
+
+/////// CMD21 ///////////////////////////////////////////
+typedef CH376Command<CMD21_SET_BAUDRATE, 2, CMDF_OUT> CmdSetBaudrate;
+
+/////// CMD14 ///////////////////////////////////////////
+typedef CH376Command<CMD14_READ_VAR32, 1, CMDF_OUT | CMDF_DATA> CmdReadVar32;	// output: low byte, followed by the other 3 bytes
+
+/////// CMD0H ///////////////////////////////////////////
+typedef CH376Command<CMD0H_AUTO_SETUP, 0, CMDF_INT> CmdAutoSetup;
+typedef CH376Command<CMD0H_BYTE_RD_GO, 0, CMDF_INT, USB_INT_DISK_READ, USB_INT_SUCCESS> CmdByteReadGo;
+typedef CH376Command<CMD0H_BYTE_WR_GO, 0, CMDF_INT, USB_INT_DISK_WRITE, USB_INT_SUCCESS> CmdByteWriteGo;
+typedef CH376Command<CMD0H_DIR_CREATE, 0, CMDF_INT> CmdDirCreate;
+typedef CH376Command<CMD0H_DIR_INFO_SAVE, 0, CMDF_INT> CmdDirInfoSave;
+typedef CH376Command<CMD0H_DISK_BOC_CMD, 0, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdDiskBocCmd;
+typedef CH376Command<CMD0H_DISK_CAPACITY, 0, CMDF_INT, 0, 0, USB_INT_SUCCESS> CmdDiskCapacity;	// result: DiskCapacity, not answered by every firmware
+typedef CH376Command<CMD0H_DISK_CONNECT, 0, CMDF_INT> CmdDiskConnect;
+typedef CH376Command<CMD0H_DISK_INIT, 0, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdDiskInit;
+typedef CH376Command<CMD0H_DISK_INQUIRY, 0, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdDiskInquiry;
+typedef CH376Command<CMD0H_DISK_MAX_LUN, 0, CMDF_INT> CmdDiskMaxLUN;
+typedef CH376Command<CMD0H_DISK_MOUNT, 0, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdDiskMount;
+typedef CH376Command<CMD0H_DISK_QUERY, 0, CMDF_INT, USB_INT_DISK_READ, 0, USB_INT_DISK_READ> CmdDiskQuery;
+typedef CH376Command<CMD0H_DISK_RD_GO, 0, CMDF_INT, USB_INT_DISK_READ, USB_INT_SUCCESS> CmdDiskReadGo;
+typedef CH376Command<CMD0H_DISK_READY, 0, CMDF_INT> CmdDiskReady;
+typedef CH376Command<CMD0H_DISK_RESET, 0, CMDF_INT> CmdDiskReset;
+typedef CH376Command<CMD0H_DISK_R_SENSE, 0, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdDiskRequestSense;
+typedef CH376Command<CMD0H_DISK_SIZE, 0, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdDiskSize;	// result: SCSI READ CAPACITY, big endian
+typedef CH376Command<CMD0H_DISK_WR_GO, 0, CMDF_INT, USB_INT_DISK_WRITE, USB_INT_SUCCESS> CmdDiskWriteGo;
+typedef CH376Command<CMD0H_FILE_CREATE, 0, CMDF_INT> CmdFileCreate;
+typedef CH376Command<CMD0H_FILE_ENUM_GO, 0, CMDF_INT, 0, 0, USB_INT_DISK_READ> CmdFileEnumGo;	// ERR_MISS_FILE ends the listing
+typedef CH376Command<CMD0H_FILE_ERASE, 0, CMDF_INT> CmdFileErase;
+typedef CH376Command<CMD0H_FILE_OPEN, 0, CMDF_INT, 0, 0, USB_INT_SUCCESS> CmdFileOpen;	// also ERR_MISS_FILE, ERR_OPEN_DIR, USB_INT_DISK_READ (wildcard)
+typedef CH376Command<CMD0H_RD_DISK_SEC, 0, CMDF_INT> CmdReadDiskSector;
+typedef CH376Command<CMD0H_WR_DISK_SEC, 0, CMDF_INT> CmdWriteDiskSector;
+
+/////// CMD1H ///////////////////////////////////////////
+typedef CH376Command<CMD1H_CLR_STALL, 1, CMDF_INT> CmdClearStall;
+typedef CH376Command<CMD1H_DIR_INFO_READ, 1, CMDF_INT> CmdDirInfoRead;
+typedef CH376Command<CMD1H_FILE_CLOSE, 1, CMDF_INT> CmdFileClose;
+typedef CH376Command<CMD1H_GET_DESCR, 1, CMDF_INT> CmdGetDescriptor;
+typedef CH376Command<CMD1H_ISSUE_TOKEN, 1, CMDF_INT> CmdIssueToken;
+typedef CH376Command<CMD1H_SEC_READ, 1, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdSectorRead;	// result: SectorRead, allowed count and start LBA
+typedef CH376Command<CMD1H_SEC_WRITE, 1, CMDF_INT, USB_INT_SUCCESS, 0, USB_INT_SUCCESS> CmdSectorWrite;	// result: SectorWrite
+typedef CH376Command<CMD1H_SET_ADDRESS, 1, CMDF_INT> CmdSetAddress;
+typedef CH376Command<CMD1H_SET_CONFIG, 1, CMDF_INT> CmdSetConfig;
+
+/////// CMD2H ///////////////////////////////////////////
+typedef CH376Command<CMD2H_BYTE_READ, 2, CMDF_INT, USB_INT_SUCCESS, USB_INT_DISK_READ> CmdByteRead;
+typedef CH376Command<CMD2H_BYTE_WRITE, 2, CMDF_INT, USB_INT_SUCCESS, USB_INT_DISK_WRITE> CmdByteWrite;
+typedef CH376Command<CMD2H_ISSUE_TKN_X, 2, CMDF_INT> CmdIssueTokenX;
+
+/////// CMDxH ///////////////////////////////////////////
+typedef CH376Command<CMD4H_BYTE_LOCATE, 4, CMDF_INT> CmdByteLocate;
+typedef CH376Command<CMD4H_SEC_LOCATE, 4, CMDF_INT> CmdSectorLocate;
+typedef CH376Command<CMD5H_DISK_READ, 5, CMDF_INT, USB_INT_DISK_READ, USB_INT_SUCCESS> CmdDiskRead;	// input: LBA (4 bytes, LSB first), sector count
+typedef CH376Command<CMD5H_DISK_WRITE, 5, CMDF_INT, USB_INT_DISK_WRITE, USB_INT_SUCCESS> CmdDiskWrite;
+
+#endif // CH376CMD_H
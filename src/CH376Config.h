@@ -0,0 +1,89 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CH376CONFIG_H
+#define CH376CONFIG_H
+
+// Compile time settings of the library. The library sources are compiled separately from the sketch,
+// so change them here or pass them as build flags (e.g. -DCH376_TRANSPORT=CH376_TRANSPORT_UART).
+
+/////// Communication bus ///////////////////////////////
+#define CH376_TRANSPORT_SPI 0		// SPI, with or without INT pin (default)
+#define CH376_TRANSPORT_UART 1		// hardware or software serial port
+#define CH376_TRANSPORT_PARALLEL 2	// 8 bit parallel bus, status port polling
+#define CH376_TRANSPORT_LINUX 3		// embedded Linux host: spidev + GPIO lines, see CH376Linux.h
+
+#ifndef CH376_TRANSPORT
+#if defined(__linux__) && !defined(ARDUINO)
+#define CH376_TRANSPORT CH376_TRANSPORT_LINUX
+#else
+#define CH376_TRANSPORT CH376_TRANSPORT_SPI
+#endif
+#endif
+
+//#define CH376_SOFTWARE_SERIAL // UART transport on a SoftwareSerial port instead of a HardwareSerial port
+//#define CH376_LINUX_GPIOD // Linux transport: SCS/INT# through libgpiod (v1 API, link with -lgpiod) instead of sysfs
+
+/////// Data phase //////////////////////////////////////
+//#define CH376_SPI_DMA // readStream()/writeStream() move the data blocks with non-blocking DMA (Adafruit SAMD core), other cores transfer them blocking
+
+/////// Row writer ////////////////////////////////////
+#ifndef CH376_ROW_SIZE
+#define CH376_ROW_SIZE 64 // bytes of the beginRow()/field()/endRow() buffer, longer rows are written in pieces
+#endif
+#if CH376_ROW_SIZE < 16
+#error "CH376_ROW_SIZE must be at least 16"
+#endif
+
+/////// Command completion //////////////////////////////
+#ifndef CH376_INT_SLOTS
+#define CH376_INT_SLOTS 4 // number of CH376 instances which can use interrupt driven completion at the same time
+#endif
+#if CH376_INT_SLOTS < 1 || CH376_INT_SLOTS > 4
+#error "CH376_INT_SLOTS must be 1..4"
+#endif
+
+/////// Tracing ///////////////////////////////////////
+#define CH376_TRACE_OFF 0		// no trace code is compiled in (default)
+#define CH376_TRACE_ERRORS 1	// print error codes
+#define CH376_TRACE_COMMANDS 2	// print every command with its arguments, status and duration
+#define CH376_TRACE_DATA 3		// print the data phases as well
+
+#ifndef CH376_TRACE_LEVEL
+#define CH376_TRACE_LEVEL CH376_TRACE_OFF
+#endif
+#ifndef CH376_TRACE_PORT
+#if CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+#define CH376_TRACE_PORT CH376Stdout
+#else
+#define CH376_TRACE_PORT Serial // Print object the trace is written to
+#endif
+#endif
+#ifndef CH376_TRACE_RING
+#define CH376_TRACE_RING 0 // number of commands kept in the binary trace ring, read back with dumpTrace()
+#endif
+
+#if CH376_TRACE_LEVEL >= CH376_TRACE_COMMANDS || CH376_TRACE_RING > 0
+#define CH376_TRACING // commands are timed and passed to traceCommand()
+#endif
+
+#endif // CH376CONFIG_H
@@ -6,6 +6,7 @@
 
 #ifndef __CH376INC_H__
 #define __CH376INC_H__
+#include <stdint.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,28 +20,28 @@ extern "C" {
 #define NULL 0
 #endif
 #ifndef UINT8
-	typedef unsigned char UINT8;
+	typedef uint8_t UINT8;
 #endif
 #ifndef UINT16
-	typedef unsigned short UINT16;
+	typedef uint16_t UINT16;
 #endif
 #ifndef UINT32
-	typedef unsigned long UINT32;
+	typedef uint32_t UINT32; /* fixed width, the chip's structures keep their layout on 32/64 bit hosts */
 #endif
 #ifndef PUINT8
-	typedef unsigned char* PUINT8;
+	typedef uint8_t* PUINT8;
 #endif
 #ifndef PUINT16
-	typedef unsigned short* PUINT16;
+	typedef uint16_t* PUINT16;
 #endif
 #ifndef PUINT32
-	typedef unsigned long* PUINT32;
+	typedef uint32_t* PUINT32;
 #endif
 #ifndef UINT8V
-	typedef unsigned char volatile UINT8V;
+	typedef uint8_t volatile UINT8V;
 #endif
 #ifndef PUINT8V
-	typedef unsigned char volatile* PUINT8V;
+	typedef uint8_t volatile* PUINT8V;
 #endif
 
 #define ANSWTIMEOUT 1000
@@ -0,0 +1,171 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "CH376Files.h"
+
+CH376FileTable::CH376FileTable(CH376MSC& drive) : _drive(drive) {
+	for (uint8_t i = 0; i < CH376_FILE_HANDLES; i++) {
+		_handles[i]._table = this;
+	}
+}
+
+CH376FileHandle* CH376FileTable::open(const char* path, uint8_t mode, uint8_t* buffer, uint16_t b_size) {
+	CH376FileHandle* handle = NULL;
+	if (mode < CH376_FILE_READ || mode > CH376_FILE_APPEND || strlen(path) >= CH376_PATH_MAX) return NULL;
+	for (uint8_t i = 0; i < CH376_FILE_HANDLES; i++) {
+		if (!_handles[i]._mode) {
+			handle = &_handles[i];
+			break;
+		}
+	}
+	if (!handle) return NULL;
+	strcpy(handle->_path, path);
+	handle->_mode = mode;
+	handle->_cursor = 0;
+	handle->_pending = 0;
+	handle->_buffer = b_size ? buffer : NULL;
+	handle->_bufSize = buffer ? b_size : 0;
+	if (!activate(handle)) { // check the file now, not at the first access
+		handle->_mode = 0;
+		return NULL;
+	}
+	handle->_size = _drive.getFileSize(); // 0 for a new file, not the size of the slot's last file
+	if (mode == CH376_FILE_APPEND) _drive.moveCursor(DEF_CURSOR_END); // stops at the end of the file
+	return handle;
+}
+
+bool CH376FileTable::flushAll() {
+	bool tmpRet = true;
+	for (uint8_t i = 0; i < CH376_FILE_HANDLES; i++) {
+		if (_handles[i]._mode && _handles[i]._pending && !activate(&_handles[i])) tmpRet = false;
+	}
+	return tmpRet;
+}
+
+void CH376FileTable::closeAll() {
+	for (uint8_t i = 0; i < CH376_FILE_HANDLES; i++) {
+		if (_handles[i]._mode) _handles[i].close();
+	}
+}
+
+bool CH376FileTable::activate(CH376FileHandle* handle) { // open the file of the handle on the chip
+	char dir[CH376_PATH_MAX];
+	const char* name;
+	uint8_t tmpReturn;
+	uint16_t pending;
+	_accesses++;
+	if (_active == handle) return true;
+	deactivate();
+	if (!_drive.getDeviceStatus()) return false;
+	strcpy(dir, handle->_path);
+	name = strrchr(dir, '/');
+	if (name) {
+		dir[name - dir] = '\0';
+		name = handle->_path + (name - dir) + 1;
+		if (dir[0] && _drive.cd(dir, false) != ERR_OPEN_DIR) return false; // the directory is missing
+	}
+	else name = handle->_path;
+	_drive.setFileName(name);
+	tmpReturn = _drive.openFile();
+	if (tmpReturn != USB_INT_SUCCESS && (tmpReturn != ERR_MISS_FILE || handle->_mode == CH376_FILE_READ)) return false;
+	_switches++;
+	_active = handle;
+	pending = handle->_pending;
+	handle->_pending = 0;
+	if (handle->_cursor > pending) _drive.moveCursor(handle->_cursor - pending);
+	if (pending) return _drive.writeRaw(handle->_buffer, pending); // the queued writes go first
+	return true;
+}
+
+void CH376FileTable::deactivate() { // close the chip's open file, the handle keeps its cursor
+	if (!_active) return;
+	_active->_cursor = _drive.getCursorPos();
+	_active->_size = _drive.getFileSize();
+	_active = NULL;
+	_drive.closeFile(); // commits the length, back to the root dir
+}
+
+uint32_t CH376FileTable::getSwitches() {
+	return _switches;
+}
+
+uint32_t CH376FileTable::getAccesses() {
+	return _accesses;
+}
+
+void CH376FileTable::resetStats() {
+	_switches = 0;
+	_accesses = 0;
+}
+
+size_t CH376FileHandle::read(uint8_t* buffer, size_t length) {
+	if (!_mode || !_table->activate(this)) return 0;
+	_table->_drive.readRaw(buffer, length);
+	return _table->_drive.getStreamLen();
+}
+
+size_t CH376FileHandle::write(const uint8_t* buffer, size_t length) {
+	CH376MSC& drive = _table->_drive;
+	if (_mode != CH376_FILE_WRITE && _mode != CH376_FILE_APPEND) return 0;
+	if (_table->_active != this && length <= (size_t)(_bufSize - _pending)) { // queue it, no switch
+		memcpy(_buffer + _pending, buffer, length);
+		_pending += length;
+		_cursor += length;
+		if (_cursor > _size) _size = _cursor;
+		return length;
+	}
+	if (!_table->activate(this)) return 0;
+	if (!drive.writeRaw((uint8_t*)buffer, length)) return 0; // disk full
+	return length;
+}
+
+bool CH376FileHandle::seek(uint32_t position) {
+	if (!_mode) return false;
+	if (_table->_active != this && !_pending) { // takes effect at the next switch
+		_cursor = min(position, _size);
+		return true;
+	}
+	if (!_table->activate(this)) return false;
+	return _table->_drive.moveCursor(position) == USB_INT_SUCCESS;
+}
+
+uint32_t CH376FileHandle::position() {
+	return (_table->_active == this) ? _table->_drive.getCursorPos() : _cursor;
+}
+
+uint32_t CH376FileHandle::size() {
+	return (_table->_active == this) ? _table->_drive.getFileSize() : _size;
+}
+
+bool CH376FileHandle::close() {
+	bool tmpRet = true;
+	if (!_mode) return false;
+	if (_pending) tmpRet = _table->activate(this);
+	if (_table->_active == this) _table->deactivate();
+	_mode = 0;
+	return tmpRet;
+}
+
+const char* CH376FileHandle::getPath() {
+	return _path;
+}
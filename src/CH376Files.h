@@ -0,0 +1,95 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef CH376FILES_H
+#define CH376FILES_H
+
+#include "CH376MSC.h"
+
+// The chip has one open file. CH376FileTable keeps several CH376FileHandle entries, each with its own
+// path, cursor and mode, and opens the file of a handle on the chip when the handle is accessed.
+// A switch closes the current file (committing its length), opens the other one and restores its cursor
+// with moveCursor(). Writes to a handle which is not open are queued in the handle's buffer and written
+// at its next switch, so several small writes to a second file cost one switch instead of one each.
+// Don't use the CH376MSC directly while handles are open.
+
+#ifndef CH376_FILE_HANDLES
+#define CH376_FILE_HANDLES 4 // handles per table
+#endif
+#define CH376_PATH_MAX 41 // /DIR1/DIR2/DIR3/FILENAME.EXT + NULL, see MAXDIRDEPTH
+
+#define CH376_FILE_READ 1 // the file must exist
+#define CH376_FILE_WRITE 2 // read and write from the beginning, created if missing
+#define CH376_FILE_APPEND 3 // read and write from the end, created if missing
+
+class CH376FileTable;
+
+class CH376FileHandle {
+public:
+	size_t read(uint8_t* buffer, size_t length); // returns the bytes read, 0 at the end of the file
+	size_t write(const uint8_t* buffer, size_t length); // returns the bytes written or queued
+	bool seek(uint32_t position);
+	uint32_t position();
+	uint32_t size();
+	bool close();
+	const char* getPath();
+
+private:
+	friend class CH376FileTable;
+
+	CH376FileTable* _table = NULL;
+	char _path[CH376_PATH_MAX];
+	uint8_t _mode = 0; // 0 = free slot
+	uint32_t _cursor = 0; // while the file is not open on the chip
+	uint32_t _size = 0;
+	uint8_t* _buffer = NULL; // queued writes, they start at _cursor - _pending
+	uint16_t _bufSize = 0;
+	uint16_t _pending = 0;
+};
+
+class CH376FileTable {
+public:
+	CH376FileTable(CH376MSC& drive);
+
+	CH376FileHandle* open(const char* path, uint8_t mode, uint8_t* buffer = NULL, uint16_t b_size = 0); // NULL if the file can't be opened or no handle is free
+	bool flushAll(); // write every queued write, the handles with queued data are visited once each
+	void closeAll();
+
+	uint32_t getSwitches(); // chip file switches
+	uint32_t getAccesses(); // handle accesses which needed the chip's open file
+	void resetStats();
+
+private:
+	friend class CH376FileHandle;
+
+	bool activate(CH376FileHandle* handle);
+	void deactivate();
+
+	CH376MSC& _drive;
+	CH376FileHandle _handles[CH376_FILE_HANDLES];
+	CH376FileHandle* _active = NULL; // handle of the chip's open file
+	uint32_t _switches = 0;
+	uint32_t _accesses = 0;
+};
+
+#endif // CH376FILES_H
@@ -0,0 +1,134 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "CH376Config.h"
+
+#if CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+#include "CH376Linux.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#ifdef CH376_LINUX_GPIOD
+#include <gpiod.h>
+#endif
+
+CH376StdoutPrint CH376Stdout;
+
+#ifndef CH376_LINUX_GPIOD
+static int sysfsLine(unsigned line, bool output) { // export the line, set its direction and open its value file
+	char path[48];
+	int len;
+	int fd = open("/sys/class/gpio/export", O_WRONLY);
+	if (fd >= 0) {
+		len = snprintf(path, sizeof(path), "%u", line);
+		if (write(fd, path, len) < 0) {} // EBUSY: already exported
+		close(fd);
+	}
+	snprintf(path, sizeof(path), "/sys/class/gpio/gpio%u/direction", line);
+	fd = open(path, O_WRONLY);
+	if (fd < 0) return -1;
+	len = output ? write(fd, "high", 4) : write(fd, "in", 2); // "high": output, starting deselected
+	close(fd);
+	if (len < 0) return -1;
+	snprintf(path, sizeof(path), "/sys/class/gpio/gpio%u/value", line);
+	return open(path, output ? O_WRONLY : O_RDONLY);
+}
+#endif
+
+CH376SpidevHAL::CH376SpidevHAL(const char* device, unsigned csLine, unsigned intLine, uint32_t speedHz, const char* gpioChip) {
+	_device = device;
+	_gpioChip = gpioChip;
+	_csLine = csLine;
+	_intLine = intLine;
+	_speedHz = speedHz;
+}
+
+CH376SpidevHAL::~CH376SpidevHAL() {
+	if (_spiFd >= 0) close(_spiFd);
+#ifdef CH376_LINUX_GPIOD
+	if (_cs) gpiod_line_release(_cs);
+	if (_int) gpiod_line_release(_int);
+	if (_chip) gpiod_chip_close(_chip);
+#else
+	if (_csFd >= 0) close(_csFd);
+	if (_intFd >= 0) close(_intFd);
+#endif
+}
+
+bool CH376SpidevHAL::begin() {
+	uint8_t mode = SPI_MODE_0 | SPI_NO_CS; // SCS is a GPIO line, the chip ends a command when it goes high
+	uint8_t bits = 8;
+	_spiFd = open(_device, O_RDWR);
+	if (_spiFd < 0) return false;
+	if (ioctl(_spiFd, SPI_IOC_WR_MODE, &mode) < 0) return false;
+	if (ioctl(_spiFd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) return false;
+	if (ioctl(_spiFd, SPI_IOC_WR_MAX_SPEED_HZ, &_speedHz) < 0) return false;
+#ifdef CH376_LINUX_GPIOD
+	_chip = gpiod_chip_open_by_name(_gpioChip);
+	if (!_chip) return false;
+	_cs = gpiod_chip_get_line(_chip, _csLine);
+	_int = gpiod_chip_get_line(_chip, _intLine);
+	if (!_cs || !_int) return false;
+	if (gpiod_line_request_output(_cs, "CH376", 1) < 0) return false;
+	if (gpiod_line_request_input(_int, "CH376") < 0) return false;
+#else
+	_csFd = sysfsLine(_csLine, true);
+	_intFd = sysfsLine(_intLine, false);
+	if (_csFd < 0 || _intFd < 0) return false;
+#endif
+	return true;
+}
+
+void CH376SpidevHAL::select(bool active) {
+#ifdef CH376_LINUX_GPIOD
+	gpiod_line_set_value(_cs, active ? 0 : 1);
+#else
+	if (pwrite(_csFd, active ? "0" : "1", 1, 0) < 0) {}
+#endif
+}
+
+void CH376SpidevHAL::transfer(const CH376LinuxXfer* xfers, uint8_t count) { // all segments in one SPI_IOC_MESSAGE
+	struct spi_ioc_transfer msg[CH376_LINUX_XFERS];
+	memset(msg, 0, sizeof(msg));
+	for (uint8_t i = 0; i < count; i++) {
+		msg[i].tx_buf = (unsigned long)xfers[i].tx;
+		msg[i].rx_buf = (unsigned long)xfers[i].rx;
+		msg[i].len = xfers[i].len;
+		msg[i].delay_usecs = xfers[i].delayUs;
+		msg[i].speed_hz = _speedHz;
+		msg[i].bits_per_word = 8;
+	}
+	ioctl(_spiFd, SPI_IOC_MESSAGE(count), msg);
+}
+
+bool CH376SpidevHAL::intActive() {
+#ifdef CH376_LINUX_GPIOD
+	return gpiod_line_get_value(_int) == 0;
+#else
+	char value = '1';
+	if (pread(_intFd, &value, 1, 0) < 0) return false;
+	return value == '0';
+#endif
+}
+#endif
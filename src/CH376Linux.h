@@ -0,0 +1,182 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef CH376LINUX_H
+#define CH376LINUX_H
+
+// CH376_TRANSPORT_LINUX: the part of the Arduino API the library uses, and the hardware abstraction
+// the Linux backend (CH376LinuxPort) talks to. CH376SpidevHAL drives /dev/spidev and two GPIO lines,
+// any other CH376LinuxHAL, e.g. an in-process chip model, can take its place.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#pragma region Arduino
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+#define F(str) (str)
+#define lowByte(w) ((uint8_t)((w) & 0xFF))
+#define highByte(w) ((uint8_t)((w) >> 8))
+template <typename A, typename B> static inline auto min(A a, B b) -> decltype(a < b ? a : b) { return a < b ? a : b; } // functions, not macros: <algorithm> stays usable
+template <typename A, typename B> static inline auto max(A a, B b) -> decltype(a > b ? a : b) { return a > b ? a : b; }
+
+inline uint32_t micros() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+inline uint32_t millis() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+inline void delayMicroseconds(uint32_t us) {
+	struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+	while (nanosleep(&ts, &ts) != 0) {} // resume after a signal
+}
+inline void delay(uint32_t ms) { delayMicroseconds(ms * 1000); }
+inline void noInterrupts() {} // no ISR on this backend
+inline void interrupts() {}
+
+inline char* ultoa(unsigned long value, char* str, int base) {
+	char tmp[sizeof(unsigned long) * 8];
+	uint8_t n = 0;
+	char* out = str;
+	do {
+		uint8_t digit = value % base;
+		tmp[n++] = (digit < 10) ? '0' + digit : 'a' + digit - 10;
+		value /= base;
+	} while (value);
+	while (n) *out++ = tmp[--n];
+	*out = '\0';
+	return str;
+}
+inline char* ltoa(long value, char* str, int base) {
+	if (value < 0 && base == 10) {
+		*str = '-';
+		ultoa(-(unsigned long)value, str + 1, base);
+		return str;
+	}
+	return ultoa((unsigned long)value, str, base);
+}
+inline char* itoa(int value, char* str, int base) { return ltoa(value, str, base); }
+inline char* dtostrf(double value, signed char width, unsigned char prec, char* str) {
+	sprintf(str, "%*.*f", width, prec, value);
+	return str;
+}
+
+class Print { // print()/println() as used by the trace output
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	size_t write(const char* str) {
+		size_t n = 0;
+		while (*str) n += write((uint8_t)*str++);
+		return n;
+	}
+	size_t print(const char* str) { return write(str); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned long value, int base = DEC) {
+		char buf[sizeof(unsigned long) * 8 + 1];
+		return write(ultoa(value, buf, base));
+	}
+	size_t print(long value, int base = DEC) {
+		char buf[sizeof(long) * 8 + 2];
+		return write(ltoa(value, buf, base));
+	}
+	size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+	size_t print(int value, int base = DEC) { return print((long)value, base); }
+	size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+	size_t print(double value, int digits = 2) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.*f", digits, value);
+		return write(buf);
+	}
+	size_t println() { return write('\n'); }
+	template <typename T> size_t println(T value) { return print(value) + println(); }
+	template <typename T> size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+class CH376StdoutPrint : public Print {
+public:
+	size_t write(uint8_t c) { return (fputc(c, stdout) == EOF) ? 0 : 1; }
+	using Print::write;
+};
+extern CH376StdoutPrint CH376Stdout; // default CH376_TRACE_PORT
+#pragma endregion
+
+#pragma region HAL
+#define CH376_LINUX_XFERS 8 // segments per SPI message
+
+struct CH376LinuxXfer { // one segment of an SPI message, SCS stays low across all segments
+	const uint8_t* tx; // NULL: clock out zeros
+	uint8_t* rx; // NULL: discard
+	uint16_t len;
+	uint16_t delayUs; // pause after the segment (TSC after the command byte)
+};
+
+class CH376LinuxHAL {
+public:
+	virtual ~CH376LinuxHAL() {}
+	virtual bool begin() = 0;
+	virtual void select(bool active) = 0; // SCS low while active
+	virtual void transfer(const CH376LinuxXfer* xfers, uint8_t count) = 0; // count <= CH376_LINUX_XFERS
+	virtual bool intActive() = 0; // INT# is low
+};
+
+class CH376SpidevHAL : public CH376LinuxHAL {
+public:
+	// csLine/intLine: line offsets on gpioChip with CH376_LINUX_GPIOD, global sysfs GPIO numbers otherwise
+	CH376SpidevHAL(const char* device, unsigned csLine, unsigned intLine, uint32_t speedHz = 2000000, const char* gpioChip = "gpiochip0");
+	virtual ~CH376SpidevHAL();
+
+	bool begin();
+	void select(bool active);
+	void transfer(const CH376LinuxXfer* xfers, uint8_t count);
+	bool intActive();
+
+private:
+	const char* _device;
+	const char* _gpioChip;
+	unsigned _csLine;
+	unsigned _intLine;
+	uint32_t _speedHz;
+	int _spiFd = -1;
+#ifdef CH376_LINUX_GPIOD
+	struct gpiod_chip* _chip = NULL;
+	struct gpiod_line* _cs = NULL;
+	struct gpiod_line* _int = NULL;
+#else
+	int _csFd = -1; // sysfs value files
+	int _intFd = -1;
+#endif
+};
+#pragma endregion
+
+#endif // CH376LINUX_H
@@ -22,8 +22,18 @@
 
 #include "CH376MSC.h"
 
-CH376MSC::CH376MSC(uint8_t spiSelect, uint8_t intPin, SPISettings speed) : CH376(spiSelect, intPin, speed) {}
-CH376MSC::CH376MSC(uint8_t spiSelect, SPISettings speed) : CH376(spiSelect, speed) {}
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+CH376MSC::CH376MSC(CH376SerialType& serialPort, uint32_t speed) : CH376(serialPort, speed) {}
+#elif CH376_TRANSPORT == CH376_TRANSPORT_PARALLEL
+CH376MSC::CH376MSC(const uint8_t dataPins[8], uint8_t a0Pin, uint8_t wrPin, uint8_t rdPin, uint8_t csPin) : CH376(dataPins, a0Pin, wrPin, rdPin, csPin) {}
+#elif CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+CH376MSC::CH376MSC(CH376LinuxHAL& hal) : CH376(hal) {}
+#else
+CH376MSC::CH376MSC(uint8_t spiSelect, uint8_t intPin, SPIClock speed) : CH376(spiSelect, intPin, speed) {}
+CH376MSC::CH376MSC(uint8_t spiSelect, SPIClock speed) : CH376(spiSelect, speed) {}
+CH376MSC::CH376MSC(SPIClass& spiBus, uint8_t spiSelect, uint8_t intPin, SPIClock speed) : CH376(spiBus, spiSelect, intPin, speed) {}
+CH376MSC::CH376MSC(SPIClass& spiBus, uint8_t spiSelect, SPIClock speed) : CH376(spiBus, spiSelect, speed) {}
+#endif
 CH376MSC::~CH376MSC() {
 	//  Auto-generated destructor stub
 }
@@ -34,8 +44,8 @@ bool CH376MSC::driveReady() {//returns TRUE if the drive ready
 		if (!_dirDepth) {// just check SD card if it's in root dir
 			setMode(MODE_HOST_0);//reinit otherwise is not possible to detect if the SD card is removed
 			setMode(MODE_HOST_SD);
-			if (diskMount() == USB_INT_SUCCESS) {
-				if (diskQuery(true) == USB_INT_DISK_READ) {
+			if (run<CmdDiskMount>() == USB_INT_SUCCESS) {
+				if (runRead<CmdDiskQuery>(DiskQueryInfo) == USB_INT_DISK_READ) {
 					_deviceAttached = true;
 				}
 			}
@@ -46,8 +56,8 @@ bool CH376MSC::driveReady() {//returns TRUE if the drive ready
 		else tmpReturn = USB_INT_SUCCESS;//end if not ROOT
 	}
 	else {//if USB
-		if (diskMount() == USB_INT_SUCCESS) {
-			if (diskQuery(true) == USB_INT_DISK_READ) {
+		if (run<CmdDiskMount>() == USB_INT_SUCCESS) {
+			if (runRead<CmdDiskQuery>(DiskQueryInfo) == USB_INT_DISK_READ) {
 				_deviceAttached = true;
 			}
 		}//end if not INT SUCCESS
@@ -58,8 +68,9 @@ bool CH376MSC::driveReady() {//returns TRUE if the drive ready
 bool CH376MSC::checkIntMessage() {
 	uint8_t tmpReturn = 0;
 	bool intRequest = false;
-	while (!digitalRead(_intPin)) {
-		tmpReturn = getInterrupt();
+	if (_cmdPending) commandStatus(); // the interrupt of a deferred command is its completion, not a connect event
+	while (intPending()) {
+		tmpReturn = takeInterrupt();
 		delay(10);
 	}
 	switch (tmpReturn) {
@@ -76,12 +87,29 @@ bool CH376MSC::checkIntMessage() {
 }
 
 void CH376MSC::setFileName(const char* filename){
+	flush(); // the collected bytes belong to the open file
+	_rbLen = 0; // and so does the read-ahead
+	_rbPos = 0;
+	_dirStatus = 0; // a new name ends a readDir() listing
+	if (_rootPending) cd("/", 0); // deferred from closeFile()
 	CH376::setFileName(filename);
 }
 
 uint8_t CH376MSC::openFile() {
 	if (!_deviceAttached) return 0x00;
-	return fileOpen(true);
+	_dirStatus = 0; // FILE_OPEN replaces the enumeration
+	_answer = runRead<CmdFileOpen>(OpenDirInfo); // ERR_MISS_FILE: the next write creates the file
+	if (_answer == ERR_MISS_FILE) memset(&OpenDirInfo, 0, sizeof(OpenDirInfo)); // not the entry of the last listDir()/readDir()
+	return _answer;
+}
+
+uint8_t CH376MSC::openName(const char* filename) { // SET_FILE_NAME and FILE_OPEN in one transfer
+	if (_rootPending) cd("/", 0);
+	if (!_deviceAttached) return 0x00;
+	_dirStatus = 0; // cd(), listDir() and readDir() itself come through here
+	beginBatch();
+	CH376::setFileName(filename);
+	return runRead<CmdFileOpen>(OpenDirInfo);
 }
 
 uint8_t CH376MSC::saveFileAttrb() {
@@ -89,9 +117,10 @@ uint8_t CH376MSC::saveFileAttrb() {
 	if (!_deviceAttached) return 0x00;
 	_fileWrite = 1;
 
-	dirInfoRead(0xff);
+	run<CmdDirInfoRead>(0xff);
+	beginBatch();
 	writeFatData();//send fat data
-	return dirInfoSave();
+	return run<CmdDirInfoSave>();
 }
 
 uint8_t CH376MSC::closeFile() { // 0x00 - w/o filesize update, 0x01 with filesize update
@@ -99,11 +128,23 @@ uint8_t CH376MSC::closeFile() { // 0x00 - w/o filesize update, 0x01 with filesiz
 	uint8_t d = 0x00;
 	if (!_deviceAttached) return 0x00;
 
+	flush();
 	if (_fileWrite == 1) { // if closing file after write procedure
 		d = 0x01; // close with 0x01 (to update file length)
 	}
+	if (_preallocated) { // the chip's length covers the zero filled clusters, the directory gets the valid length
+		run<CmdSetFileSize>(VAR_FILE_SIZE, (uint8_t)OpenDirInfo.DIR_FileSize, (uint8_t)(OpenDirInfo.DIR_FileSize >> 8),
+			(uint8_t)(OpenDirInfo.DIR_FileSize >> 16), (uint8_t)(OpenDirInfo.DIR_FileSize >> 24));
+		d = 0x01;
+	}
 
-	tmpReturn = fileClose(d);
+	if (_asyncMode) { // the chip closes the file in the background, back to the root dir with the next file name
+		deferCommand(CMD1H_FILE_CLOSE, USB_INT_SUCCESS, USB_INT_SUCCESS, &d, 1);
+		_rootPending = true;
+		rstFileContainer();
+		return USB_INT_SUCCESS;
+	}
+	tmpReturn = run<CmdFileClose>(d);
 
 	cd("/", 0);//back to the root directory if any file operation has occurred
 	rstFileContainer();
@@ -113,7 +154,7 @@ uint8_t CH376MSC::closeFile() { // 0x00 - w/o filesize update, 0x01 with filesiz
 uint8_t CH376MSC::deleteFile() {
 	if (!_deviceAttached) return 0x00;
 	openFile();
-	_answer = fileErase();
+	_answer = run<CmdFileErase>();
 	cd("/", 0);
 	return _answer;
 }
@@ -129,6 +170,7 @@ uint8_t CH376MSC::listDir(const char* filename) {
 	bool moreFiles = true;  // more files waiting for read out
 	bool doneFiles = false; // done with reading a file
 	uint32_t tmOutCnt = millis();
+	_dirStatus = 0; // listDir() moves the chip's enumeration with FILE_ENUM_GO too
 
 	while (!doneFiles) {
 		if (millis() - tmOutCnt >= ANSWTIMEOUT) setError(ERR_TIMEOUT);
@@ -138,8 +180,7 @@ uint8_t CH376MSC::listDir(const char* filename) {
 		}
 		switch (fileProcesSTM) {
 		case REQUEST:
-			setFileName(filename);
-			_answer = openFile();
+			_answer = openName(filename);
 			//_fileWrite = 2; // if in subdir
 			fileProcesSTM = READWRITE;
 			break;
@@ -154,7 +195,7 @@ uint8_t CH376MSC::listDir(const char* filename) {
 			}
 			break;
 		case NEXT:
-			_answer = fileEnumGo(); // go for the next filename
+			_answer = run<CmdFileEnumGo>(); // go for the next filename
 			fileProcesSTM = DONE;
 			break;
 		case DONE:
@@ -173,9 +214,54 @@ uint8_t CH376MSC::listDir(const char* filename) {
 	return moreFiles;
 }
 
+uint16_t CH376MSC::readDir(CH376DirEntry* entries, uint16_t count, const char* pattern, uint8_t skipAttr) { // continues until it returns less than count
+	FAT_DIR_INFO tmpInfo;
+	uint16_t tmpDone = 0;
+	if (!_deviceAttached) return 0;
+	if (!_dirStatus) _dirStatus = openName(pattern); // the chip matches the pattern, USB_INT_DISK_READ with every entry
+	while (tmpDone < count && _dirStatus == USB_INT_DISK_READ && _deviceAttached) {
+		beginBatch(); // entry and FILE_ENUM_GO in one transfer
+		uint8_t length = readUSBData0((uint8_t*)&tmpInfo, sizeof(tmpInfo));
+		_dirStatus = run<CmdFileEnumGo>();
+		if (length != sizeof(tmpInfo) || (uint8_t)tmpInfo.DIR_Name[0] == 0xE5 || (tmpInfo.DIR_Attr & skipAttr)) continue; // deleted or filtered out
+		dirEntry(tmpInfo, entries[tmpDone++]);
+	}
+	if (_dirStatus != USB_INT_DISK_READ) _dirStatus = 0; // ERR_MISS_FILE: end of the directory, the next call starts again
+	return tmpDone;
+}
+
+void CH376MSC::rewindDir() {
+	_dirStatus = 0;
+}
+
+void CH376MSC::dirEntry(const FAT_DIR_INFO& info, CH376DirEntry& entry) { // "NAME    EXT" to "NAME.EXT"
+	uint8_t len = 0;
+	for (uint8_t i = 0; i < 8 && info.DIR_Name[i] != ' '; i++) entry.name[len++] = info.DIR_Name[i];
+	if (info.DIR_Name[8] != ' ') {
+		entry.name[len++] = '.';
+		for (uint8_t i = 8; i < 11 && info.DIR_Name[i] != ' '; i++) entry.name[len++] = info.DIR_Name[i];
+	}
+	entry.name[len] = '\0';
+	entry.attr = info.DIR_Attr;
+	entry.date = info.DIR_WrtDate;
+	entry.time = info.DIR_WrtTime;
+	entry.size = info.DIR_FileSize;
+}
+
 uint8_t CH376MSC::moveCursor(uint32_t position) {
 	uint8_t tmpReturn = 0;
 	if (!_deviceAttached) return 0x00;
+	flush();
+	if (_rbLen && position + _rbPos >= CursorPos.mSectorLba && position + _rbPos <= CursorPos.mSectorLba + _rbLen) { // inside the read-ahead buffer
+		_rbPos = position + _rbPos - CursorPos.mSectorLba;
+		CursorPos.mSectorLba = position;
+		return USB_INT_SUCCESS;
+	}
+	_rbLen = 0;
+	_rbPos = 0;
+	if (_preallocated && position > OpenDirInfo.DIR_FileSize) { // the chip's length covers the zero fill, append at the valid end
+		position = OpenDirInfo.DIR_FileSize;
+	}
 
 	if (position > OpenDirInfo.DIR_FileSize) {	//fix for moveCursor issue #3 Sep 17, 2019
 		_sectorCounter = OpenDirInfo.DIR_FileSize % DEF_SECTOR_SIZE;
@@ -184,7 +270,7 @@ uint8_t CH376MSC::moveCursor(uint32_t position) {
 		_sectorCounter = position % DEF_SECTOR_SIZE;
 	}
 	CursorPos.mSectorLba = position;//temporary
-	tmpReturn = movePointer(CursorPos.mByte[0], CursorPos.mByte[1], CursorPos.mByte[2], CursorPos.mByte[3]);
+	tmpReturn = run<CmdByteLocate>(CursorPos.mByte[0], CursorPos.mByte[1], CursorPos.mByte[2], CursorPos.mByte[3]);
 
 	if (CursorPos.mSectorLba > OpenDirInfo.DIR_FileSize) {
 		CursorPos.mSectorLba = OpenDirInfo.DIR_FileSize;//set the valid position
@@ -198,19 +284,18 @@ uint8_t CH376MSC::cd(const char* dirPath, bool mkDir) {
 	if (!_deviceAttached) return 0x00;
 
 	_dirDepth = 0;
+	_rootPending = false;
 	if (pathLen < ((MAXDIRDEPTH * 8) + (MAXDIRDEPTH + 1))) {//depth*(8char filename)+(directory separators)
 		char input[pathLen + 1];
 		strcpy(input, dirPath);
-		setFileName("/");
-		tmpReturn = openFile();
+		tmpReturn = openName("/");
 		char* command = strtok(input, "/");//split path into tokens
 		while (command != NULL && !_errorCode) {
 			if (strlen(command) > 8) {//if a dir name is longer than 8 char
 				tmpReturn = ERR_LONGFILENAME;
 				break;
 			}
-			setFileName(command);
-			tmpReturn = openFile();
+			tmpReturn = openName(command);
 			if (tmpReturn == USB_INT_SUCCESS) {//if file already exist with this name
 				tmpReturn = ERR_FOUND_NAME;
 				closeFile();
@@ -233,102 +318,101 @@ uint8_t CH376MSC::cd(const char* dirPath, bool mkDir) {
 uint8_t CH376MSC::deleteDir() {
 
 	if (!_deviceAttached) return 0x00;
-	_answer = fileErase();
+	_answer = run<CmdFileErase>();
 
 	cd("/", 0);
 	return _answer;
 }
 
 #pragma region Write
-uint8_t CH376MSC::writeFile(char* buffer, uint8_t b_size) {
-	return writeMachine((uint8_t*)buffer, b_size);
+uint8_t CH376MSC::writeFile(char* buffer, size_t b_size) {
+	return bufferedWrite((uint8_t*)buffer, b_size);
 }
 
-uint8_t CH376MSC::writeRaw(uint8_t* buffer, uint8_t b_size) {
-	if (b_size == 0) b_size = sizeof(buffer);
-	return writeMachine(buffer, b_size);
+uint8_t CH376MSC::writeRaw(uint8_t* buffer, size_t b_size) {
+	return bufferedWrite(buffer, b_size);
 }
 
 uint8_t CH376MSC::writeChar(char trmChar) {
-	return writeMachine((uint8_t*)&trmChar, 1);
+	return bufferedWrite((uint8_t*)&trmChar, 1);
 }
 
 uint8_t CH376MSC::writeNum(uint8_t buffer) {
 	char strBuffer[4];//max 255 = 3+1 char
 	itoa(buffer, strBuffer, 10);
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNum(int8_t buffer) {
 	char strBuffer[5];//max -128 = 4+1 char
 	itoa(buffer, strBuffer, 10);
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNumln(uint8_t buffer) {
 	char strBuffer[6];//max 255 = 3+2+1 char
 	itoa(buffer, strBuffer, 10);
 	strcat(strBuffer, "\r\n");
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNumln(int8_t buffer) {
 	char strBuffer[7];//max -128 = 4+2+1 char
 	itoa(buffer, strBuffer, 10);
 	strcat(strBuffer, "\r\n");
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNum(uint16_t buffer) {
 	char strBuffer[6];//max 65535 = 5+1 char
 	itoa(buffer, strBuffer, 10);
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNum(int16_t buffer) {
 	char strBuffer[7];//max -32768 = 6+1 char
 	itoa(buffer, strBuffer, 10);
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNumln(uint16_t buffer) {
 	char strBuffer[8];//max 65535 = 5+2+1 char
 	itoa(buffer, strBuffer, 10);
 	strcat(strBuffer, "\r\n");
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNumln(int16_t buffer) {
 	char strBuffer[9];//max -32768 = 6+2+1 char
 	itoa(buffer, strBuffer, 10);
 	strcat(strBuffer, "\r\n");
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNum(uint32_t buffer) {
 	char strBuffer[11];//max 4 294 967 295 = 10+1 char
 	ltoa(buffer, strBuffer, 10);
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNum(int32_t buffer) {
 	char strBuffer[12];//max -2147483648 = 11+1 char
 	ltoa(buffer, strBuffer, 10);
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNumln(uint32_t buffer) {
 	char strBuffer[13];//max 4 294 967 295 = 10+2+1 char
 	ltoa(buffer, strBuffer, 10);
 	strcat(strBuffer, "\r\n");
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNumln(int32_t buffer) {
 	char strBuffer[14];//max -2147483648 = 11+2+1 char
 	ltoa(buffer, strBuffer, 10);
 	strcat(strBuffer, "\r\n");
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNum(double buffer) {
@@ -339,7 +423,7 @@ uint8_t CH376MSC::writeNum(double buffer) {
 	else {
 		dtostrf(buffer, 1, 2, strBuffer);
 	}
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeNumln(double buffer) {
@@ -351,28 +435,27 @@ uint8_t CH376MSC::writeNumln(double buffer) {
 		dtostrf(buffer, 1, 2, strBuffer);
 	}
 	strcat(strBuffer, "\r\n");
-	return writeMachine((uint8_t*)strBuffer, strlen(strBuffer));
+	return bufferedWrite((uint8_t*)strBuffer, strlen(strBuffer));
 }
 
 uint8_t CH376MSC::writeDataFromBuff(uint8_t* buffer) {//====================
-	uint8_t oldCounter = _byteCounter; //old buffer counter
+	size_t oldCounter = _byteCounter; //old buffer counter
 	uint8_t dataLength; // data stream size
 
-	dataLength = writeRequestedData(); // data stream size
+	dataLength = run<CmdWriteReqData>(); // data stream size
 
-	while (_byteCounter < (dataLength + oldCounter)) {
-		spiWrite(buffer[_byteCounter]); // read data from buffer and write to serial port
-		_byteCounter++;
-	}//end while
-	spiEndTransfer();
+	portWriteMultiple(buffer + oldCounter, dataLength); // write the requested block from the buffer in one transfer
+	_byteCounter += dataLength;
+	portEndTransfer();
 	return dataLength;
 }
 
-uint8_t CH376MSC::writeMachine(uint8_t* buffer, uint8_t b_size) {
+uint8_t CH376MSC::writeMachine(uint8_t* buffer, size_t b_size) {
 	bool diskFree = true; //free space on a disk
 	bool bufferFull = true; //continue to write while there is data in the temporary buffer
 	uint32_t tmOutCnt = 0;
-	if (!_deviceAttached) return 0x00;
+	if (!_deviceAttached || b_size == 0) return 0x00; // BYTE_WRITE 0 would end in an error status and a detach
+	dropReadAhead(); // write where the application is, not where the chip has read to
 	_fileWrite = 1; // read mode, required for close procedure
 	_byteCounter = 0;
 
@@ -380,15 +463,7 @@ uint8_t CH376MSC::writeMachine(uint8_t* buffer, uint8_t b_size) {
 		diskFree = false;
 		return diskFree;
 	}
-	if (_answer == ERR_MISS_FILE) { // no file with given name
-		_answer = fileCreate();
-	}//end if CREATED
-
-	if (_answer == ERR_FILE_CLOSE) {
-		_answer = openFile();
-	}
-
-	if (_answer == USB_INT_SUCCESS) { // file created succesfully
+	if (openForWrite()) { // file created succesfully
 		tmOutCnt = millis();
 		while (bufferFull) {
 			if (millis() - tmOutCnt >= ANSWTIMEOUT) setError(ERR_TIMEOUT);
@@ -398,7 +473,7 @@ uint8_t CH376MSC::writeMachine(uint8_t* buffer, uint8_t b_size) {
 			}
 			switch (fileProcesSTM) {
 			case REQUEST:
-				_answer = reqByteWrite(b_size - _byteCounter);
+				_answer = reqByteWrite(min(b_size - _byteCounter, (size_t)0xFFFF)); // longer buffers are chained in 16 bit requests
 
 				if (_answer == USB_INT_SUCCESS) {
 					fileProcesSTM = NEXT;
@@ -410,6 +485,7 @@ uint8_t CH376MSC::writeMachine(uint8_t* buffer, uint8_t b_size) {
 				break;
 			case READWRITE:
 				writeDataFromBuff(buffer);
+				tmOutCnt = millis(); // the timeout is per block, not per call
 				if (_byteCounter != b_size) {
 					fileProcesSTM = NEXT;
 				}
@@ -420,7 +496,7 @@ uint8_t CH376MSC::writeMachine(uint8_t* buffer, uint8_t b_size) {
 			case NEXT:
 				if (DiskQueryInfo.mFreeSector > 0) {
 					DiskQueryInfo.mFreeSector--;
-					_answer = byteWriteGo();
+					_answer = run<CmdByteWriteGo>();
 					if (_answer == USB_INT_SUCCESS) {
 						fileProcesSTM = REQUEST;
 					}
@@ -436,8 +512,13 @@ uint8_t CH376MSC::writeMachine(uint8_t* buffer, uint8_t b_size) {
 			case DONE:
 				fileProcesSTM = REQUEST;
 				CursorPos.mSectorLba += _byteCounter;
+				if (CursorPos.mSectorLba > OpenDirInfo.DIR_FileSize) OpenDirInfo.DIR_FileSize = CursorPos.mSectorLba; // the chip keeps its own length, this one is for moveCursor/getEOF
 				_byteCounter = 0;
-				_answer = byteWriteGo();
+				if (_asyncMode) {
+					defer<CmdByteWriteGo>(); // completed by the next command or commandStatus()
+					_answer = USB_INT_SUCCESS; // the file stays open for the next write
+				}
+				else _answer = run<CmdByteWriteGo>();
 				bufferFull = false;
 				break;
 			}//end switch
@@ -446,43 +527,384 @@ uint8_t CH376MSC::writeMachine(uint8_t* buffer, uint8_t b_size) {
 
 	return diskFree;
 }
+
+void CH376MSC::setWriteBuffer(uint8_t* buffer, uint16_t b_size) { // NULL or 0 = write through
+	flush();
+	_wbBuffer = b_size ? buffer : NULL;
+	_wbSize = buffer ? b_size : 0;
+	_wbFill = 0;
+}
+
+uint8_t CH376MSC::flush() { // write the collected bytes with one BYTE_WRITE sequence
+	uint8_t tmpReturn = true;
+	if (_wbFill == 0) return tmpReturn;
+	tmpReturn = writeMachine(_wbBuffer, _wbFill);
+	_wbTransactions++;
+	_wbFill = 0;
+	return tmpReturn;
+}
+
+uint32_t CH376MSC::getSavedWrites() {
+	return (_wbWrites > _wbTransactions) ? _wbWrites - _wbTransactions : 0;
+}
+
+uint16_t CH376MSC::sectorPart(uint16_t b_size) { // bytes from the cursor which end on a sector boundary, max. b_size
+	uint16_t tail = (CursorPos.mSectorLba + b_size) % DEF_SECTOR_SIZE;
+	if (tail < b_size) return b_size - tail;
+	return b_size; // shorter than the way to the next boundary
+}
+
+uint8_t CH376MSC::bufferedWrite(const uint8_t* buffer, size_t b_size) { // the public writes end here
+	uint8_t tmpReturn;
+	if (_wbSize) tmpReturn = collectWrite(buffer, b_size);
+	else tmpReturn = writeMachine((uint8_t*)buffer, b_size);
+	if (tmpReturn) syncPoint(b_size);
+	return tmpReturn;
+}
+
+uint8_t CH376MSC::collectWrite(const uint8_t* buffer, size_t b_size) { // through the write buffer
+	uint8_t tmpReturn = true;
+	if (!_deviceAttached) return 0x00;
+	if (DiskQueryInfo.mFreeSector == 0) return false;
+	dropReadAhead();
+	_wbWrites++;
+	while (b_size && tmpReturn) {
+		uint16_t limit = sectorPart(_wbSize); // the cursor stays at the first buffered byte
+		size_t part;
+		if (_wbFill == 0 && b_size >= limit) { // nothing to merge with, write from the caller's buffer
+			part = limit;
+			if ((CursorPos.mSectorLba + limit) % DEF_SECTOR_SIZE == 0) part += (b_size - limit) / DEF_SECTOR_SIZE * DEF_SECTOR_SIZE; // and the whole sectors after it
+			tmpReturn = writeMachine((uint8_t*)buffer, part);
+			_wbTransactions++;
+		}
+		else {
+			part = min(b_size, (size_t)(limit - _wbFill));
+			memcpy(_wbBuffer + _wbFill, buffer, part);
+			_wbFill += part;
+			if (_wbFill == limit) tmpReturn = flush();
+		}
+		buffer += part;
+		b_size -= part;
+	}
+	return tmpReturn;
+}
+
+void CH376MSC::setSyncPolicy(SyncPolicy policy, uint32_t interval) { // interval: bytes for SYNC_BYTES, ms for SYNC_MS
+	_syncPolicy = policy;
+	_syncInterval = interval;
+	_syncBytes = 0;
+	_syncTime = millis();
+}
+
+uint8_t CH376MSC::sync() { // write the file length into the directory entry, the file stays open
+	uint32_t size;
+	if (!_deviceAttached) return 0x00;
+	flush();
+	_syncBytes = 0;
+	_syncTime = millis();
+	if (_fileWrite != 1) return USB_INT_SUCCESS; // nothing written since the last sync
+	size = OpenDirInfo.DIR_FileSize;
+	run<CmdDirInfoRead>(0xff); // the chip's copy of the entry, with the clusters it has allocated
+	beginBatch();
+	run<CmdWriteOffsetData>(offsetof(FAT_DIR_INFO, DIR_FileSize), sizeof(size));
+	portWriteMultiple((const uint8_t*)&size, sizeof(size));
+	portEndTransfer();
+	_answer = run<CmdDirInfoSave>();
+	if (_answer == USB_INT_SUCCESS) _fileWrite = 0; // closeFile() has no length to update
+	return _answer;
+}
+
+void CH376MSC::syncPoint(uint32_t written) {
+	_syncBytes += written;
+	switch (_syncPolicy) {
+	case SYNC_EVERY_WRITE:
+		sync();
+		break;
+	case SYNC_BYTES:
+		if (_syncBytes >= _syncInterval) sync();
+		break;
+	case SYNC_MS:
+		if (millis() - _syncTime >= _syncInterval) sync();
+		break;
+	default: // SYNC_MANUAL: sync() and closeFile()
+		break;
+	}
+}
+
+bool CH376MSC::openForWrite() {
+	if (_answer == ERR_MISS_FILE) { // no file with given name
+		_answer = run<CmdFileCreate>();
+	}//end if CREATED
+
+	if (_answer == ERR_FILE_CLOSE) {
+		_answer = openFile();
+	}
+	return (_answer == USB_INT_SUCCESS);
+}
+
+uint32_t CH376MSC::writeStream(uint8_t* buffer0, uint8_t* buffer1, uint16_t b_size, CH376FillFn fill) {
+	uint8_t* buffers[2] = { buffer0, buffer1 };
+	uint16_t length[2] = { 0, 0 };
+	uint8_t cur = 0;
+	uint32_t total = 0;
+	if (!_deviceAttached || !fill || DiskQueryInfo.mFreeSector == 0) return 0;
+	flush();
+	dropReadAhead();
+	_fileWrite = 1;
+	if (!openForWrite()) return 0;
+
+	length[cur] = fill(buffers[cur], b_size);
+	while (length[cur] && _deviceAttached) {
+		uint16_t pos = 0;
+		bool nextFilled = false;
+		_answer = run<CmdByteWrite>(lowByte(length[cur]), highByte(length[cur]));
+		while (_answer == USB_INT_DISK_WRITE) {
+			uint8_t dataLength = run<CmdWriteReqData>(); // the transfer stays open for the block
+			portWriteAsync(buffers[cur] + pos, dataLength);
+			if (CH376Port::asyncData && !nextFilled) { // the application fills the other buffer while this one is on the wire
+				length[cur ^ 1] = fill(buffers[cur ^ 1], b_size);
+				nextFilled = true;
+			}
+			portWaitData();
+			portEndTransfer();
+			pos += dataLength;
+			startCommand(CmdByteWriteGo::op);
+			if (!nextFilled) { // or while the chip writes the block
+				length[cur ^ 1] = fill(buffers[cur ^ 1], b_size);
+				nextFilled = true;
+			}
+			_answer = checkStatus(commandStatus(), CmdByteWriteGo::ok, CmdByteWriteGo::ok2);
+		}
+		if (_answer != USB_INT_SUCCESS) break;
+		if (!nextFilled) length[cur ^ 1] = fill(buffers[cur ^ 1], b_size);
+		total += length[cur];
+		CursorPos.mSectorLba += length[cur];
+		if (CursorPos.mSectorLba > OpenDirInfo.DIR_FileSize) OpenDirInfo.DIR_FileSize = CursorPos.mSectorLba;
+		cur ^= 1;
+	}
+	syncPoint(total);
+	return total;
+}
+#pragma endregion
+
+#pragma region Row
+void CH376MSC::setRowFormat(char separator, const char* lineEnd) { // lineEnd must stay valid, e.g. a string literal
+	_rowSep = separator;
+	_rowEnd = lineEnd;
+}
+
+void CH376MSC::beginRow() {
+	_rowLen = 0;
+	_rowFields = 0;
+	_rowFailed = false;
+}
+
+void CH376MSC::field(long value) {
+	char strBuffer[3 * sizeof(long) + 2];//-2147483648 = 11+1 char, 64 bit long fits as well
+	ltoa(value, strBuffer, 10);
+	rowField(strBuffer);
+}
+
+void CH376MSC::field(unsigned long value) {
+	char strBuffer[3 * sizeof(long) + 2];
+	ultoa(value, strBuffer, 10);
+	rowField(strBuffer);
+}
+
+void CH376MSC::field(int value) {
+	field((long)value);
+}
+
+void CH376MSC::field(unsigned int value) {
+	field((unsigned long)value);
+}
+
+void CH376MSC::field(double value, uint8_t precision) {
+	char strBuffer[20];
+	if (value > 4100000.00 || value < -4100000.00) {// same limit as writeNum()
+		strcpy(strBuffer, "ovf");
+	}
+	else {
+		dtostrf(value, 1, min(precision, (uint8_t)7), strBuffer);
+	}
+	rowField(strBuffer);
+}
+
+void CH376MSC::field(const char* text) {
+	rowField(text);
+}
+
+uint8_t CH376MSC::endRow() { // returns FALSE if the disk is full
+	rowAppend(_rowEnd, strlen(_rowEnd));
+	if (_rowLen && !bufferedWrite((uint8_t*)_row, _rowLen)) _rowFailed = true;
+	_rowLen = 0;
+	_rowFields = 0;
+	return !_rowFailed;
+}
+
+void CH376MSC::rowField(const char* text) {
+	if (_rowFields++) rowAppend(&_rowSep, 1);
+	rowAppend(text, strlen(text));
+}
+
+void CH376MSC::rowAppend(const char* text, size_t length) { // a row longer than the buffer is written in pieces
+	while (length) {
+		if (_rowLen == CH376_ROW_SIZE) {
+			if (!bufferedWrite((uint8_t*)_row, _rowLen)) _rowFailed = true;
+			_rowLen = 0;
+		}
+		size_t part = min(length, (size_t)(CH376_ROW_SIZE - _rowLen));
+		memcpy(_row + _rowLen, text, part);
+		_rowLen += part;
+		text += part;
+		length -= part;
+	}
+}
+#pragma endregion
+
+#pragma region Record
+bool CH376MSC::recordHeader(uint16_t recordSize, uint16_t schema) { // after openFile(): write the header of an empty file, check an existing one
+	CH376RecordHeader header;
+	_recordSize = 0;
+	if (!_deviceAttached || recordSize == 0) return false;
+	if (_answer == ERR_MISS_FILE || OpenDirInfo.DIR_FileSize == 0) { // new or empty file
+		header = { CH376_RECORD_MAGIC, CH376_RECORD_VERSION, 0, recordSize, schema, 0 };
+		if (!writeRaw((uint8_t*)&header, sizeof(header))) return false;
+	}
+	else {
+		moveCursor(0);
+		readRaw((uint8_t*)&header, sizeof(header));
+		if (_streamLength != sizeof(header) || header.magic != CH376_RECORD_MAGIC || header.version != CH376_RECORD_VERSION
+			|| header.recordSize != recordSize || header.schema != schema) {
+			return false; // not a record file or written by another version of the struct
+		}
+	}
+	_recordSize = recordSize;
+	return true;
+}
+
+uint8_t CH376MSC::seekRecord(uint32_t index) { // index = getRecordCount() to append
+	if (!_recordSize) return 0x00;
+	return moveCursor(sizeof(CH376RecordHeader) + index * _recordSize);
+}
+
+uint32_t CH376MSC::getRecordCount() {
+	uint32_t length = max(OpenDirInfo.DIR_FileSize, getCursorPos()); // with the bytes in the write buffer
+	if (!_recordSize || length < sizeof(CH376RecordHeader)) return 0;
+	return (length - sizeof(CH376RecordHeader)) / _recordSize;
+}
+
+bool CH376MSC::readRecordData(void* record, uint16_t recordSize) {
+	if (recordSize != _recordSize) return false;
+	readRaw((uint8_t*)record, recordSize);
+	return _streamLength == recordSize; // false at the end of the file
+}
+
+uint8_t CH376MSC::writeRecordData(const void* record, uint16_t recordSize) {
+	if (recordSize != _recordSize) return 0x00;
+	return bufferedWrite((const uint8_t*)record, recordSize);
+}
 #pragma endregion
 
 #pragma region Read
-bool CH376MSC::readFileUntil(char trmChar, char* buffer, uint8_t b_size) {
-	if (b_size == 0) b_size = sizeof(buffer);
-	char tmpBuff[2];//temporary buffer to read string and analyze
-	bool readMore = true;
-	uint8_t charCnt = 0;
+uint32_t CH376MSC::readStream(uint8_t* buffer0, uint8_t* buffer1, uint16_t b_size, CH376DrainFn drain, uint32_t length) {
+	uint8_t* buffers[2] = { buffer0, buffer1 };
+	uint8_t cur = 0;
+	int8_t ready = -1; // full buffer waiting for the application
+	uint16_t readyLength = 0;
+	uint16_t fillLength = 0;
+	uint32_t total = 0;
+	if (!_deviceAttached || !drain || b_size < CH376_DAT_BLOCK_LEN) return 0;
+	flush();
+	dropReadAhead();
+	_fileWrite = 0; // read mode, required for close procedure
+	if (CursorPos.mSectorLba >= OpenDirInfo.DIR_FileSize) return 0;
+	if (length > OpenDirInfo.DIR_FileSize - CursorPos.mSectorLba) length = OpenDirInfo.DIR_FileSize - CursorPos.mSectorLba;
+
+	while (length && _deviceAttached) {
+		uint16_t request = (length > 0xFFFF) ? 0xFFFF : length;
+		uint16_t received = 0;
+		_answer = run<CmdByteRead>(lowByte(request), highByte(request));
+		while (_answer == USB_INT_DISK_READ) {
+			uint8_t dataLength = run<CmdReadUSBData0>(); // the transfer stays open for the block
+			if (dataLength > b_size - fillLength) { // the chip never sends more than CH376_DAT_BLOCK_LEN
+				portEndTransfer();
+				setError(ERR_OVERFLOW);
+				break;
+			}
+			portReadAsync(buffers[cur] + fillLength, dataLength);
+			if (CH376Port::asyncData && ready >= 0) { // drain the other buffer while this block is on the wire
+				drain(buffers[ready], readyLength);
+				ready = -1;
+			}
+			portWaitData();
+			portEndTransfer();
+			fillLength += dataLength;
+			received += dataLength;
+			if (b_size - fillLength < CH376_DAT_BLOCK_LEN) { // no room for another block, hand it over
+				ready = cur;
+				readyLength = fillLength;
+				cur ^= 1;
+				fillLength = 0;
+			}
+			startCommand(CmdByteReadGo::op);
+			if (ready >= 0) { // or while the chip fetches the next block
+				drain(buffers[ready], readyLength);
+				ready = -1;
+			}
+			_answer = checkStatus(commandStatus(), CmdByteReadGo::ok, CmdByteReadGo::ok2);
+		}
+		total += received;
+		CursorPos.mSectorLba += received;
+		length -= received;
+		if (_answer != USB_INT_SUCCESS || received < request) break; // error or end of file
+	}
+	if (ready >= 0) drain(buffers[ready], readyLength);
+	if (fillLength) drain(buffers[cur], fillLength);
+	return total;
+}
+
+bool CH376MSC::readFileUntil(char trmChar, char* buffer, size_t b_size) {
+	size_t charCnt = 0;
+	char* found = NULL; // terminate character
+	if (!_deviceAttached || b_size == 0) return false;
 	b_size--;// last byte is reserved for NULL terminating character
-	if (!_deviceAttached) return false;
-	for (; charCnt < b_size; charCnt++) {
-		readMore = readFile(tmpBuff, sizeof(tmpBuff));
-		buffer[charCnt] = tmpBuff[0];
-		if ((tmpBuff[0] == trmChar) || !readMore) {// reach terminate character or EOF
-			readMore = false;
-			break;
+	if (_rbSize) { // scan the read-ahead buffer
+		while (charCnt < b_size && !found) {
+			if (_rbPos == _rbLen && !fillReadAhead()) break; // EOF
+			size_t part = min(b_size - charCnt, (size_t)(_rbLen - _rbPos));
+			found = (char*)memchr(_rbBuffer + _rbPos, trmChar, part);
+			if (found) part = found - (char*)_rbBuffer - _rbPos + 1;
+			memcpy(buffer + charCnt, _rbBuffer + _rbPos, part);
+			_rbPos += part;
+			charCnt += part;
+			CursorPos.mSectorLba += part;
 		}
 	}
-	buffer[charCnt + 1] = 0x00;//string terminate
-	return readMore;
+	else { // read ahead into the given buffer and step back behind the terminate character
+		readRaw((uint8_t*)buffer, b_size);
+		charCnt = _streamLength;
+		found = (char*)memchr(buffer, trmChar, charCnt);
+		if (found && (size_t)(found - buffer + 1) < charCnt) {
+			moveCursor(CursorPos.mSectorLba - (charCnt - (found - buffer + 1)));
+			charCnt = found - buffer + 1;
+		}
+	}
+	buffer[charCnt] = 0x00;//string terminate, after the terminate character
+	return !found && charCnt == b_size; // buffer is full
 }
 
-uint8_t CH376MSC::readFile(char* buffer, uint8_t b_size) {
-	if (b_size == 0) b_size = sizeof(buffer);
+uint8_t CH376MSC::readFile(char* buffer, size_t b_size) {
 	uint8_t tmpReturn;
-	b_size--;// last byte is reserved for NULL terminating character
-	tmpReturn = readMachine((uint8_t*)buffer, b_size);
-	buffer[_byteCounter] = '\0';// NULL terminating char
-	CursorPos.mSectorLba += _byteCounter;
-	_streamLength = _byteCounter;
-	_byteCounter = 0;
+	if (b_size == 0) return 0;
+	tmpReturn = readRaw((uint8_t*)buffer, b_size - 1);// last byte is reserved for NULL terminating character
+	buffer[_streamLength] = '\0';// NULL terminating char
 	return tmpReturn;
 }
 
-uint8_t CH376MSC::readRaw(uint8_t* buffer, uint8_t b_size) {
-	if (b_size == 0) b_size = sizeof(buffer);
+uint8_t CH376MSC::readRaw(uint8_t* buffer, size_t b_size) {
 	uint8_t tmpReturn;
+	if (_rbSize) return readAhead(buffer, b_size);
 	tmpReturn = readMachine(buffer, b_size);
 	CursorPos.mSectorLba += _byteCounter;
 	_streamLength = _byteCounter;
@@ -490,6 +912,51 @@ uint8_t CH376MSC::readRaw(uint8_t* buffer, uint8_t b_size) {
 	return tmpReturn;
 }
 
+void CH376MSC::setReadBuffer(uint8_t* buffer, uint16_t b_size) { // NULL or 0 = read through
+	dropReadAhead();
+	_rbBuffer = b_size ? buffer : NULL;
+	_rbSize = buffer ? b_size : 0;
+}
+
+uint16_t CH376MSC::fillReadAhead() { // read the next sector aligned piece of the file, returns its length (0 = EOF)
+	_rbLen = 0;
+	_rbPos = 0;
+	readMachine(_rbBuffer, sectorPart(_rbSize));
+	_rbLen = _byteCounter;
+	_byteCounter = 0;
+	return _rbLen;
+}
+
+void CH376MSC::dropReadAhead() { // the chip cursor goes back to the application's position
+	bool ahead = _rbPos < _rbLen;
+	_rbLen = 0;
+	_rbPos = 0;
+	if (ahead) moveCursor(CursorPos.mSectorLba);
+}
+
+uint8_t CH376MSC::readAhead(uint8_t* buffer, size_t b_size) { // readRaw() through the read-ahead buffer
+	size_t tmpDone = 0;
+	while (tmpDone < b_size) {
+		if (_rbPos == _rbLen) {
+			if (b_size - tmpDone >= _rbSize) { // big request, straight into the given buffer
+				readMachine(buffer + tmpDone, b_size - tmpDone);
+				tmpDone += _byteCounter;
+				CursorPos.mSectorLba += _byteCounter;
+				_byteCounter = 0;
+				break;
+			}
+			if (!fillReadAhead()) break; // EOF
+		}
+		size_t part = min(b_size - tmpDone, (size_t)(_rbLen - _rbPos));
+		memcpy(buffer + tmpDone, _rbBuffer + _rbPos, part);
+		_rbPos += part;
+		tmpDone += part;
+		CursorPos.mSectorLba += part;
+	}
+	_streamLength = tmpDone;
+	return !getEOF(); // more data
+}
+
 int32_t CH376MSC::readLong(char trmChar) {
 	char workBuffer[18];
 	int32_t retval;
@@ -514,32 +981,25 @@ double CH376MSC::readDouble(char trmChar) {
 	return retval;
 }
 
-uint8_t CH376MSC::readDataToBuff(uint8_t* buffer, uint8_t b_size) {
-	if (b_size == 0) b_size = sizeof(buffer);
-	uint8_t oldCounter = _byteCounter; //old buffer counter
+uint8_t CH376MSC::readDataToBuff(uint8_t* buffer, size_t b_size) {
 	uint8_t dataLength = 0; // data stream size
 
-	dataLength = readUSBData0(); // data stream size
-	if (dataLength > b_size) {
-		setError(ERR_OVERFLOW);//overflow
-		return 0;
-	}
-	while (_byteCounter < (dataLength + oldCounter)) {
-		buffer[_byteCounter] = spiRead(); // incoming data add to buffer
-		_byteCounter++;
-	}//end while
-	spiEndTransfer();
+	dataLength = readUSBData0(buffer + _byteCounter, min(b_size - _byteCounter, (size_t)CH376_DAT_BLOCK_LEN)); // incoming data add to buffer, overflow checked
+	_byteCounter += dataLength;
 
 	return dataLength;
 }
 
-uint8_t CH376MSC::readMachine(uint8_t* buffer, uint8_t b_size) { //buffer for reading, buffer size
-	if (b_size == 0) b_size = sizeof(buffer);
+uint8_t CH376MSC::readMachine(uint8_t* buffer, size_t b_size) { //buffer for reading, buffer size
 	uint8_t tmpReturn = 0;// more data
-	uint8_t byteForRequest = 0;
+	uint16_t byteForRequest = 0;
 	bool bufferFull = false;
 	uint32_t tmOutCnt = 0;
+	flush(); // read back what was written
 	_fileWrite = 0; // read mode, required for close procedure
+	if (_preallocated && CursorPos.mSectorLba + b_size > OpenDirInfo.DIR_FileSize) { // don't read the reserved area
+		b_size = (OpenDirInfo.DIR_FileSize > CursorPos.mSectorLba) ? OpenDirInfo.DIR_FileSize - CursorPos.mSectorLba : 0;
+	}
 	if (_answer == ERR_FILE_CLOSE || _answer == ERR_MISS_FILE) {
 		bufferFull = true;
 		tmpReturn = 0;// we have reached the EOF
@@ -554,7 +1014,7 @@ uint8_t CH376MSC::readMachine(uint8_t* buffer, uint8_t b_size) { //buffer for re
 		}
 		switch (fileProcesSTM) {
 		case REQUEST:
-			byteForRequest = b_size - _byteCounter;
+			byteForRequest = min(b_size - _byteCounter, (size_t)0xFFFF);
 			if (_sectorCounter == DEF_SECTOR_SIZE) { //if one sector has read out
 				_sectorCounter = 0;
 				fileProcesSTM = NEXT;
@@ -564,7 +1024,7 @@ uint8_t CH376MSC::readMachine(uint8_t* buffer, uint8_t b_size) { //buffer for re
 				byteForRequest = DEF_SECTOR_SIZE - _sectorCounter;
 			}
 			////////////////
-			_answer = readByte(byteForRequest);
+			_answer = run<CmdByteRead>(lowByte(byteForRequest), highByte(byteForRequest));
 			if (_answer == USB_INT_DISK_READ) {
 				fileProcesSTM = READWRITE;
 				tmpReturn = 1; //we have not reached the EOF
@@ -575,7 +1035,8 @@ uint8_t CH376MSC::readMachine(uint8_t* buffer, uint8_t b_size) { //buffer for re
 			}
 			break;
 		case READWRITE:
-			_sectorCounter += readDataToBuff(buffer, byteForRequest);	//fillup the buffer
+			_sectorCounter += readDataToBuff(buffer, b_size);	//fillup the buffer
+			tmOutCnt = millis();
 			if (_byteCounter != b_size) {
 				fileProcesSTM = REQUEST;
 			}
@@ -584,7 +1045,7 @@ uint8_t CH376MSC::readMachine(uint8_t* buffer, uint8_t b_size) { //buffer for re
 			}
 			break;
 		case NEXT:
-			_answer = byteReadGo();
+			_answer = run<CmdByteReadGo>();
 			fileProcesSTM = REQUEST;
 			break;
 		case DONE:
@@ -597,41 +1058,173 @@ uint8_t CH376MSC::readMachine(uint8_t* buffer, uint8_t b_size) { //buffer for re
 }
 #pragma endregion
 
-#pragma region API
-void CH376MSC::writeFatData() {// see fat info table under next filename
-	uint8_t fatInfBuffer[32]; //temporary buffer for raw file FAT info
-	memcpy(&fatInfBuffer, &OpenDirInfo, sizeof(fatInfBuffer)); //copy raw data to temporary buffer
-	writeOffsetData((uint8_t)0x00, 32);
-	for (uint8_t d = 0; d < 32; d++) {
-		spiWrite(fatInfBuffer[d]);
+#pragma region Sector
+uint8_t CH376MSC::readSectors(uint8_t* buffer, uint8_t count) {
+	SectorRead tmpSec;
+	uint8_t tmpDone = 0;
+	if (!_deviceAttached || count == 0) return 0;
+	flush();
+	dropReadAhead();
+	if (CursorPos.mSectorLba % DEF_SECTOR_SIZE) return 0;
+	_fileWrite = 0; // read mode, required for close procedure
+	if (_driveSource == 1) return byteSectors(false, buffer, count); // SD card: no sector commands
+	while (tmpDone < count && _deviceAttached) {
+		if (runRead<CmdSectorRead>(tmpSec, count - tmpDone) != USB_INT_SUCCESS || tmpSec.mSectorCount == 0) break; // end of file
+		if (!diskIO(false, tmpSec.mStartSector, tmpSec.mSectorCount, buffer + (uint16_t)tmpDone * DEF_SECTOR_SIZE)) break;
+		tmpDone += tmpSec.mSectorCount;
+	}
+	CursorPos.mSectorLba += (uint32_t)tmpDone * DEF_SECTOR_SIZE;
+	_sectorCounter = 0;
+	return tmpDone;
+}
+
+uint8_t CH376MSC::writeSectors(const uint8_t* buffer, uint8_t count) {
+	SectorWrite tmpSec;
+	uint8_t tmpDone = 0;
+	if (!_deviceAttached || count == 0) return 0;
+	flush();
+	dropReadAhead();
+	if (CursorPos.mSectorLba % DEF_SECTOR_SIZE) return 0;
+	_fileWrite = 1; // close with file size update
+	if (_driveSource == 1) return byteSectors(true, (uint8_t*)buffer, count);
+	if (!openForWrite()) return 0;
+	while (tmpDone < count && _deviceAttached) {
+		if (runRead<CmdSectorWrite>(tmpSec, count - tmpDone) != USB_INT_SUCCESS || tmpSec.mSectorCount == 0) break; // disk full
+		if (!diskIO(true, tmpSec.mStartSector, tmpSec.mSectorCount, (uint8_t*)buffer + (uint16_t)tmpDone * DEF_SECTOR_SIZE)) break;
+		tmpDone += tmpSec.mSectorCount;
+	}
+	CursorPos.mSectorLba += (uint32_t)tmpDone * DEF_SECTOR_SIZE;
+	DiskQueryInfo.mFreeSector -= min((uint32_t)tmpDone, DiskQueryInfo.mFreeSector);
+	if (CursorPos.mSectorLba > OpenDirInfo.DIR_FileSize) { // FILE_CLOSE writes this length into the directory entry
+		OpenDirInfo.DIR_FileSize = CursorPos.mSectorLba;
+		run<CmdWriteVar32>(VAR_FILE_SIZE, CursorPos.mByte[0], CursorPos.mByte[1], CursorPos.mByte[2], CursorPos.mByte[3]);
+	}
+	_sectorCounter = 0;
+	syncPoint((uint32_t)tmpDone * DEF_SECTOR_SIZE);
+	return tmpDone;
+}
+
+bool CH376MSC::diskIO(bool write, uint32_t lba, uint8_t count, uint8_t* buffer) { // physical sectors, one CH376_DAT_BLOCK_LEN block per interrupt
+	uint8_t tmpRet;
+	if (write) {
+		tmpRet = run<CmdDiskWrite>(lba, lba >> 8, lba >> 16, lba >> 24, count);
+		while (tmpRet == USB_INT_DISK_WRITE) {
+			beginBatch(); // WR_HOST_DATA and DISK_WR_GO in one transfer
+			run<CmdWriteHostData>(CH376_DAT_BLOCK_LEN); // the transfer stays open for the block
+			if (buffer) {
+				portWriteMultiple(buffer, CH376_DAT_BLOCK_LEN);
+				buffer += CH376_DAT_BLOCK_LEN;
+			}
+			else {
+				for (uint8_t i = 0; i < CH376_DAT_BLOCK_LEN; i++) portWrite((uint8_t)0x00); // preallocate(): zero sectors
+			}
+			portEndTransfer();
+			tmpRet = run<CmdDiskWriteGo>();
+		}
 	}
-	spiEndTransfer();
+	else {
+		tmpRet = run<CmdDiskRead>(lba, lba >> 8, lba >> 16, lba >> 24, count);
+		while (tmpRet == USB_INT_DISK_READ) {
+			beginBatch(); // RD_USB_DATA0 and DISK_RD_GO in one transfer
+			buffer += readUSBData0(buffer, CH376_DAT_BLOCK_LEN);
+			tmpRet = run<CmdDiskReadGo>();
+		}
+	}
+	return tmpRet == USB_INT_SUCCESS;
 }
 
-void CH376MSC::rdFatInfo() {
-	uint8_t fatInfBuffer[32]; //temporary buffer for raw file FAT info
-	uint8_t dataLength;
-	bool owrflow = false;
+uint16_t CH376MSC::readBlocks(uint32_t lba, uint16_t count, uint8_t* buffer) { return blockIO(false, lba, count, buffer); }
+uint16_t CH376MSC::writeBlocks(uint32_t lba, uint16_t count, const uint8_t* buffer) { return blockIO(true, lba, count, (uint8_t*)buffer); }
 
-	dataLength = readUSBData0();
-	if (dataLength > sizeof(fatInfBuffer)) {
-		owrflow = true;
-		dataLength = sizeof(fatInfBuffer);
+uint16_t CH376MSC::blockIO(bool write, uint32_t lba, uint16_t count, uint8_t* buffer) {
+	uint16_t tmpDone = 0;
+	if (!_deviceAttached || _driveSource == 1) return 0; // SD card: no DISK_READ/DISK_WRITE
+	while (tmpDone < count) {
+		uint8_t part = min(count - tmpDone, 255); // mSectorCount per DISK_READ/DISK_WRITE
+		if (!diskIO(write, lba + tmpDone, part, buffer + (uint32_t)tmpDone * DEF_SECTOR_SIZE)) break;
+		tmpDone += part;
 	}
-	spiReadMultiple(fatInfBuffer, dataLength);
-	spiEndTransfer();
-
-	if (owrflow) {
-		setError(ERR_OVERFLOW);
+	run<CmdDirtyBuffer>(); // the chip's file mode buffers no longer match the disk/buffer
+	return tmpDone;
+}
+
+uint32_t CH376MSC::getCapacity() {
+	DiskCapacity tmpCap;
+	uint8_t tmpSize[8]; // last LBA and block length, big endian
+	uint8_t tmpError = _errorCode;
+	if (!_deviceAttached || _driveSource == 1) return 0;
+	if (runRead<CmdDiskCapacity>(tmpCap) == USB_INT_SUCCESS) return tmpCap.mDiskSizeSec;
+	_errorCode = tmpError; // firmware without DISK_CAPACITY may time out, the drive is still there for the fallback
+	_deviceAttached = true;
+	if (runRead<CmdDiskSize>(tmpSize) == USB_INT_SUCCESS) { // older firmware, a failure here is reported
+		return ((uint32_t)tmpSize[0] << 24 | (uint32_t)tmpSize[1] << 16 | (uint32_t)tmpSize[2] << 8 | tmpSize[3]) + 1;
 	}
-	else {
-		memcpy(&OpenDirInfo, &fatInfBuffer, sizeof(fatInfBuffer)); //copy raw data to structured variable
+	return 0;
+}
+
+bool CH376MSC::preallocate(uint32_t bytes) { // zero fill the file up to the given size, USB drive FAT16/FAT32 only
+	SectorWrite tmpSec;
+	uint8_t tmpZero[CH376_DAT_BLOCK_LEN];
+	uint32_t valid;
+	uint32_t sectors;
+	if (!_deviceAttached || _driveSource == 1) return false;
+	flush();
+	dropReadAhead();
+	valid = OpenDirInfo.DIR_FileSize;
+	if (bytes <= valid) return true;
+	_fileWrite = 1;
+	if (!openForWrite()) return false;
+	memset(tmpZero, 0, sizeof(tmpZero));
+	moveCursor(valid);
+	while (CursorPos.mSectorLba % DEF_SECTOR_SIZE && _deviceAttached) { // up to the sector boundary in byte mode
+		if (!writeRaw(tmpZero, min(DEF_SECTOR_SIZE - CursorPos.mSectorLba % DEF_SECTOR_SIZE, (uint32_t)sizeof(tmpZero)))) break;
+		flush();
+	}
+	sectors = (bytes + DEF_SECTOR_SIZE - 1) / DEF_SECTOR_SIZE - CursorPos.mSectorLba / DEF_SECTOR_SIZE;
+	while (sectors && _deviceAttached && CursorPos.mSectorLba % DEF_SECTOR_SIZE == 0) { // whole zero sectors, the normal SEC_WRITE path
+		if (runRead<CmdSectorWrite>(tmpSec, (uint8_t)min(sectors, (uint32_t)255)) != USB_INT_SUCCESS || tmpSec.mSectorCount == 0) break; // disk full
+		if (!diskIO(true, tmpSec.mStartSector, tmpSec.mSectorCount, NULL)) break;
+		sectors -= tmpSec.mSectorCount;
+		CursorPos.mSectorLba += (uint32_t)tmpSec.mSectorCount * DEF_SECTOR_SIZE;
+		DiskQueryInfo.mFreeSector -= min((uint32_t)tmpSec.mSectorCount, DiskQueryInfo.mFreeSector);
+		run<CmdWriteVar32>(VAR_FILE_SIZE, CursorPos.mByte[0], CursorPos.mByte[1], CursorPos.mByte[2], CursorPos.mByte[3]);
 	}
+	_preallocated = (CursorPos.mSectorLba > valid);
+	OpenDirInfo.DIR_FileSize = valid; // the zeros are not data, closeFile() writes the valid length
+	moveCursor(valid);
+	return sectors == 0;
 }
 
-uint8_t CH376MSC::reqByteWrite(uint8_t a) {
+uint8_t CH376MSC::byteSectors(bool write, uint8_t* buffer, uint8_t count) { // sector API on top of byte mode
+	uint8_t tmpDone = 0;
+	for (; tmpDone < count && _deviceAttached; tmpDone++) {
+		if (write) {
+			if (!writeRaw(buffer, DEF_SECTOR_SIZE)) return tmpDone;
+		}
+		else {
+			readRaw(buffer, DEF_SECTOR_SIZE);
+			if (_streamLength != DEF_SECTOR_SIZE) return tmpDone; // end of file
+		}
+		buffer += DEF_SECTOR_SIZE;
+	}
+	return tmpDone;
+}
+#pragma endregion
+
+#pragma region API
+void CH376MSC::writeFatData() {// see fat info table under next filename
+	run<CmdWriteOffsetData>(0x00, 32);
+	portWriteMultiple((const uint8_t*)&OpenDirInfo, 32); //raw file FAT info straight from the structured variable
+	portEndTransfer();
+}
+
+void CH376MSC::rdFatInfo() {
+	readUSBData0((uint8_t*)&OpenDirInfo, sizeof(OpenDirInfo)); //raw file FAT info straight to the structured variable
+}
+
+uint8_t CH376MSC::reqByteWrite(uint16_t a) {
 	uint8_t tmpReturn = 0;
-	tmpReturn = writeByte(a, (uint8_t)0x00);
+	tmpReturn = run<CmdByteWrite>(lowByte(a), highByte(a));
 
 	if (!_errorCode && (tmpReturn != USB_INT_SUCCESS) && (tmpReturn != USB_INT_DISK_WRITE)) {
 		setError(tmpReturn);
@@ -640,7 +1233,7 @@ uint8_t CH376MSC::reqByteWrite(uint8_t a) {
 }
 
 uint8_t CH376MSC::dirCreate() {
-	return dirCreate();
+	return run<CmdDirCreate>();
 }
 #pragma endregion
 
@@ -696,7 +1289,7 @@ uint32_t CH376MSC::getFileSize() {
 }
 
 uint32_t CH376MSC::getCursorPos() {
-	return CursorPos.mSectorLba;
+	return CursorPos.mSectorLba + _wbFill;
 }
 
 char* CH376MSC::getFileSizeStr() { // make formatted file size string from unsigned long
@@ -905,6 +1498,12 @@ void CH376MSC::rstFileContainer() {
 	_sectorCounter = 0;
 	CursorPos.mSectorLba = 0;
 	_streamLength = 0;
+	_wbFill = 0;
+	_rbLen = 0;
+	_rbPos = 0;
+	_recordSize = 0;
+	_preallocated = false;
+	_dirStatus = 0; // closeFile(), driveDetach()
 }
 
 void CH376MSC::resetFileList() {
@@ -925,11 +1524,11 @@ void CH376MSC::driveAttach() {
 	if (_driveSource == 0) {//if USB
 		setMode(MODE_HOST_1);
 		setMode(MODE_HOST_2);
-		tmpReturn = waitInterrupt(true);
+		tmpReturn = waitInterrupt();
 	}//end if usb
 	if (tmpReturn == USB_INT_CONNECT) {
 		for (uint8_t a = 0; a < 5; a++) { //try to mount, delay in worst case ~(number of attempts * ANSWTIMEOUT ms)
-			tmpReturn = diskMount();
+			tmpReturn = run<CmdDiskMount>();
 			if (tmpReturn == USB_INT_SUCCESS) {
 				clearError();
 				_deviceAttached = true;
@@ -941,7 +1540,7 @@ void CH376MSC::driveAttach() {
 		}//end for
 	}
 	else driveDetach();
-	if (_deviceAttached) diskQuery(true);
+	if (_deviceAttached) runRead<CmdDiskQuery>(DiskQueryInfo);
 }
 
 void CH376MSC::driveDetach() {
@@ -949,6 +1548,7 @@ void CH376MSC::driveDetach() {
 		setMode(MODE_HOST_0);
 	}
 	_deviceAttached = false;
+	_rootPending = false;
 	rstDriveContainer();
 	rstFileContainer();
 }
@@ -957,7 +1557,7 @@ bool CH376MSC::getDeviceStatus(){
 	return CH376::_deviceAttached;
 }
 
-uint8_t CH376MSC::getStreamLen() {
+size_t CH376MSC::getStreamLen() {
 	return _streamLength;
 }
 
@@ -969,12 +1569,5 @@ void CH376MSC::setError(uint8_t errCode) {
 	resetFileList();
 	rstDriveContainer();
 	rstFileContainer();
-#ifdef DEBUG
-	Serial.println();
-	Serial.print("Error:");
-	Serial.print("\t 0x");
-	Serial.print(errCode, HEX);
-	Serial.println();
-#endif
 }
 #pragma endregion
@@ -20,16 +20,60 @@
  *
  */
 
+#ifndef CH376MSC_H
+#define CH376MSC_H
+
 #include "CH376.h"
 
 #define ANSWTIMEOUT 1000
 #define MAXDIRDEPTH 3 // 3 = /subdir1/subdir2/subdir3
 
+typedef void (*CH376DrainFn)(const uint8_t* buffer, uint16_t length); // readStream(): consume one filled buffer
+typedef uint16_t (*CH376FillFn)(uint8_t* buffer, uint16_t b_size); // writeStream(): fill a buffer, return the length, 0 = end
+
+#define CH376_RECORD_MAGIC 0x43524843UL // "CHRC"
+#define CH376_RECORD_VERSION 1
+
+struct CH376RecordHeader { // first bytes of a record file, little endian, 12 bytes
+	uint32_t magic;
+	uint8_t version;
+	uint8_t reserved;
+	uint16_t recordSize;
+	uint16_t schema; // version of the record struct, chosen by the application
+	uint16_t reserved2;
+};
+static_assert(sizeof(CH376RecordHeader) == 12, "CH376RecordHeader must not be padded");
+
+struct CH376DirEntry { // readDir() record
+	char name[13]; // 8.3 with dot, NULL terminated
+	uint8_t attr; // ATTR_...
+	uint16_t date; // FAT date of the last write: (date >> 9) + 1980, (date >> 5) & 0x0F, date & 0x1F
+	uint16_t time; // FAT time: time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2
+	uint32_t size;
+};
+
+enum SyncPolicy : uint8_t { // setSyncPolicy(): when the file length of an open file is committed
+	SYNC_MANUAL,		// sync() and closeFile() only (default)
+	SYNC_EVERY_WRITE,	// after every write call
+	SYNC_BYTES,		// after the given number of bytes
+	SYNC_MS			// at the first write after the given time in ms
+};
+
 class CH376MSC : public CH376 {
 
 public:
-	CH376MSC(uint8_t spiSelect, uint8_t intPin, SPISettings speed = SPI_SCK_KHZ(125));
-	CH376MSC(uint8_t spiSelect, SPISettings speed = SPI_SCK_KHZ(125)); //with SPI, MISO as INT pin(SPI bus can`t be shared with other SPI devices)
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+	CH376MSC(CH376SerialType& serialPort, uint32_t speed = BaudRate9600); //leave the module at the default 9600bps, the speed is raised in init()
+#elif CH376_TRANSPORT == CH376_TRANSPORT_PARALLEL
+	CH376MSC(const uint8_t dataPins[8], uint8_t a0Pin, uint8_t wrPin, uint8_t rdPin, uint8_t csPin); //D0-D7, A0, WR#, RD#, CS#
+#elif CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+	CH376MSC(CH376LinuxHAL& hal); //CH376SpidevHAL or an in-process stand-in
+#else
+	CH376MSC(uint8_t spiSelect, uint8_t intPin, SPIClock speed = SPI_SCK_KHZ(125));
+	CH376MSC(uint8_t spiSelect, SPIClock speed = SPI_SCK_KHZ(125)); //with SPI, MISO as INT pin(SPI bus can`t be shared with other SPI devices)
+	CH376MSC(SPIClass& spiBus, uint8_t spiSelect, uint8_t intPin, SPIClock speed = SPI_SCK_KHZ(125)); //on a dedicated SPI controller, e.g. HSPI or a SERCOM
+	CH376MSC(SPIClass& spiBus, uint8_t spiSelect, SPIClock speed = SPI_SCK_KHZ(125));
+#endif
 	virtual ~CH376MSC();
 
 	uint8_t saveFileAttrb();
@@ -39,14 +83,48 @@ public:
 	uint8_t deleteFile();
 	uint8_t deleteDir();
 	uint8_t listDir(const char* filename = "*");
-	uint8_t readFile(char* buffer, uint8_t b_size = 0);
-	uint8_t readRaw(uint8_t* buffer, uint8_t b_size = 0);
+	uint16_t readDir(CH376DirEntry* entries, uint16_t count, const char* pattern = "*", uint8_t skipAttr = ATTR_HIDDEN | ATTR_VOLUME_ID); // returns the entries filled
+	void rewindDir();
+	uint8_t readFile(char* buffer, size_t b_size);
+	uint8_t readRaw(uint8_t* buffer, size_t b_size);
+	void setReadBuffer(uint8_t* buffer, uint16_t b_size); // read ahead in sector aligned pieces, serves readFileUntil() from RAM
 	int32_t readLong(char trmChar = '\n');
 	uint32_t readULong(char trmChar = '\n');
 	double readDouble(char trmChar = '\n');
 	uint8_t writeChar(char trmChar);
-	uint8_t writeFile(char* buffer, uint8_t b_size = 0);
-	uint8_t writeRaw(uint8_t* buffer, uint8_t b_size = 0);
+	uint8_t writeFile(char* buffer, size_t b_size);
+	uint8_t writeRaw(uint8_t* buffer, size_t b_size);
+	void setWriteBuffer(uint8_t* buffer, uint16_t b_size); // collect small writes, flushed in sector aligned chunks
+	uint8_t flush();
+	uint32_t getSavedWrites(); // BYTE_WRITE sequences saved by the write buffer
+	void setSyncPolicy(SyncPolicy policy, uint32_t interval = 0);
+	uint8_t sync(); // commit the file length, the file stays open
+	void setRowFormat(char separator = ',', const char* lineEnd = "\r\n");
+	void beginRow();
+	void field(long value);
+	void field(unsigned long value);
+	void field(int value);
+	void field(unsigned int value);
+	void field(double value, uint8_t precision = 2);
+	void field(const char* text);
+	uint8_t endRow(); // the whole row with one write
+	template<typename T> bool beginRecords(uint16_t schema) { // after openFile()
+		static_assert(__is_trivially_copyable(T), "records are written as raw bytes");
+		static_assert(sizeof(T) <= 0xFFFF, "record too large");
+		return recordHeader(sizeof(T), schema);
+	}
+	template<typename T> uint8_t writeRecord(const T& record) { return writeRecordData(&record, sizeof(T)); }
+	template<typename T> bool readRecord(T& record) { return readRecordData(&record, sizeof(T)); }
+	uint8_t seekRecord(uint32_t index);
+	uint32_t getRecordCount();
+	uint32_t readStream(uint8_t* buffer0, uint8_t* buffer1, uint16_t b_size, CH376DrainFn drain, uint32_t length = 0xFFFFFFFF);
+	uint32_t writeStream(uint8_t* buffer0, uint8_t* buffer1, uint16_t b_size, CH376FillFn fill);
+	uint8_t readSectors(uint8_t* buffer, uint8_t count); // count * 512 bytes from a sector aligned cursor, returns the sectors read
+	uint8_t writeSectors(const uint8_t* buffer, uint8_t count); // returns the sectors written
+	uint16_t readBlocks(uint32_t lba, uint16_t count, uint8_t* buffer); // raw disk, 512 byte blocks, USB drive only
+	uint16_t writeBlocks(uint32_t lba, uint16_t count, const uint8_t* buffer);
+	uint32_t getCapacity(); // blocks on the raw disk, 0 if unknown
+	bool preallocate(uint32_t bytes); // zero fill an open file up to bytes, closeFile() truncates it to the written length
 	uint8_t writeNum(uint8_t buffer);
 	uint8_t writeNum(int8_t buffer);
 	uint8_t writeNum(uint16_t buffer);
@@ -62,7 +140,7 @@ public:
 	uint8_t writeNumln(int32_t buffer);
 	uint8_t writeNumln(double buffer);
 	uint8_t cd(const char* dirPath, bool mkDir);
-	bool readFileUntil(char trmChar, char* buffer, uint8_t b_size = 0);
+	bool readFileUntil(char trmChar, char* buffer, size_t b_size);
 	bool driveReady();
 	bool checkIntMessage();
 	void setFileName(const char* filename);
@@ -80,7 +158,7 @@ public:
 	uint16_t getHour();
 	uint16_t getMinute();
 	uint16_t getSecond();
-	uint8_t getStreamLen();
+	size_t getStreamLen();
 	uint8_t getStatus();
 	uint8_t getFileSystem();
 	uint8_t getFileAttrb();
@@ -101,12 +179,30 @@ private:
 	void driveAttach();
 	void driveDetach();
 	void setError(uint8_t errCode);
-	uint8_t reqByteWrite(uint8_t a);
-	uint8_t writeMachine(uint8_t* buffer, uint8_t b_size = 0);
+	uint8_t openName(const char* filename);
+	uint8_t reqByteWrite(uint16_t a);
+	uint8_t writeMachine(uint8_t* buffer, size_t b_size);
+	uint8_t bufferedWrite(const uint8_t* buffer, size_t b_size);
+	uint8_t collectWrite(const uint8_t* buffer, size_t b_size);
+	void syncPoint(uint32_t written);
+	uint16_t sectorPart(uint16_t b_size);
+	uint16_t fillReadAhead();
+	void dropReadAhead();
+	uint8_t readAhead(uint8_t* buffer, size_t b_size);
+	void rowField(const char* text);
+	bool recordHeader(uint16_t recordSize, uint16_t schema);
+	bool readRecordData(void* record, uint16_t recordSize);
+	uint8_t writeRecordData(const void* record, uint16_t recordSize);
+	void rowAppend(const char* text, size_t length);
+	bool openForWrite();
 	uint8_t writeDataFromBuff(uint8_t* buffer);
-	uint8_t readDataToBuff(uint8_t* buffer, uint8_t b_size = 0);
-	uint8_t readMachine(uint8_t* buffer, uint8_t b_size = 0);
+	uint8_t readDataToBuff(uint8_t* buffer, size_t b_size);
+	uint8_t readMachine(uint8_t* buffer, size_t b_size);
+	bool diskIO(bool write, uint32_t lba, uint8_t count, uint8_t* buffer);
+	uint8_t byteSectors(bool write, uint8_t* buffer, uint8_t count);
+	uint16_t blockIO(bool write, uint32_t lba, uint16_t count, uint8_t* buffer);
 	uint8_t dirCreate();
+	static void dirEntry(const FAT_DIR_INFO& info, CH376DirEntry& entry);
 
 	void rdFatInfo();
 	void writeFatData();
@@ -116,15 +212,40 @@ private:
 	void rstDriveContainer();
 
 	///////Internal Variables///////////////////////////////
-	uint8_t _streamLength = 0;
+	size_t _streamLength = 0;
 	uint8_t _fileWrite = 0; // read or write mode, needed for close operation
 	uint8_t _dirDepth = 0;// Don't check SD card if it's in subdir
-	uint8_t _byteCounter = 0; //vital variable for proper reading,writing
+	size_t _byteCounter = 0; //vital variable for proper reading,writing
 	uint8_t _driveSource = 0;//0 = USB, 1 = SD
 	uint16_t _sectorCounter = 0;// variable for proper reading
 	uint8_t _answer = 0;
+	bool _rootPending = false; // async closeFile(): cd("/") is still due
+	uint8_t* _wbBuffer = NULL; // write buffer, not used if _wbSize is 0
+	uint16_t _wbSize = 0;
+	uint16_t _wbFill = 0;
+	uint32_t _wbWrites = 0; // buffered write calls
+	uint32_t _wbTransactions = 0; // writeMachine() runs for them
+	uint8_t* _rbBuffer = NULL; // read-ahead buffer, not used if _rbSize is 0
+	uint16_t _rbSize = 0;
+	uint16_t _rbLen = 0; // bytes in the buffer, the chip cursor is behind the last one
+	uint16_t _rbPos = 0; // next byte for the application, at CursorPos
+	char _row[CH376_ROW_SIZE]; // row under construction
+	uint16_t _rowLen = 0;
+	uint8_t _rowFields = 0;
+	bool _rowFailed = false;
+	char _rowSep = ',';
+	const char* _rowEnd = "\r\n";
+	uint16_t _recordSize = 0; // 0 = no record file
+	bool _preallocated = false; // the chip's file length covers the zero fill, DIR_FileSize the valid length
+	SyncPolicy _syncPolicy = SYNC_MANUAL;
+	uint32_t _syncInterval = 0;
+	uint32_t _syncBytes = 0; // written since the last sync
+	uint32_t _syncTime = 0; // millis() of the last sync
+	uint8_t _dirStatus = 0; // readDir(): 0 = not listing, USB_INT_DISK_READ = an entry is waiting, cleared by every open/close/cd
 
 	char _filename[12];
 
 	fileProcessENUM fileProcesSTM = REQUEST;
-};
\ No newline at end of file
+};
+
+#endif // CH376MSC_H
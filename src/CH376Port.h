@@ -0,0 +1,604 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CH376PORT_H
+#define CH376PORT_H
+
+#include "CH376Config.h"
+#if CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+#include "CH376Linux.h"
+#else
+#include <Arduino.h>
+#include <Stream.h>
+#include <SPI.h>
+#endif
+#include "CH376DEF.h"
+
+#ifdef CH376_SOFTWARE_SERIAL
+#include <SoftwareSerial.h>
+#endif
+
+/* Transport backends of the CH376 command layer.
+ * Every backend has the same non-virtual interface, CH376 holds the one selected with CH376_TRANSPORT,
+ * so the calls are resolved (and mostly inlined) at compile time:
+ *   begin()                     - set up pins/bus
+ *   beginTransfer/endTransfer() - frame one command sequence
+ *   nextCommand()               - end the command and start the next one within the same transfer
+ *   command(cmd)                - send a command code (sync codes, TSC pause, busy wait are handled here)
+ *   write()/read()              - data phase, single byte or block
+ *   writeAsync()/readAsync()    - start a block data phase, waitData() completes it (blocking where no DMA is available)
+ *   asyncData                   - the data phase runs in the background until waitData()
+ *   intActive()                 - the chip signals an interrupt (command completed)
+ *   pushesStatus                - the chip sends the interrupt status by itself (serial mode)
+ *   attachInt()/detachInt()     - route the INT line to an ISR, false if the backend has no usable INT line
+ *   latchInISR                  - the ISR may read GET_STATUS itself (the SPI core masks it during transactions)
+ */
+
+#define TSC_NS 1500 // datasheet TSC min 1.5uSec, from the end of the command byte to the first data byte
+
+#if CH376_TRANSPORT != CH376_TRANSPORT_LINUX // Arduino backends
+#define SPI_CHUNK_LEN 32 // stack chunk for block writes on cores without a write-only block transfer
+
+#if defined(CH376_SPI_DMA) && defined(ARDUINO_SAMD_ADAFRUIT)
+#define CH376_SPI_ASYNC // the core has SPI.transfer(tx, rx, count, block) on DMA
+#endif
+
+struct SPIClock { // SPI clock rate in Hz, kept so the TSC pause can be sized from it
+	uint32_t hz; // 0 = unknown, given as SPISettings
+	SPISettings spi;
+	SPIClock(uint32_t rate) : hz(rate), spi(rate, MSBFIRST, SPI_MODE0) {}
+	SPIClock(const SPISettings& settings) : hz(0), spi(settings) {} // sketches written for the SPISettings constructors
+	SPISettings settings() const { return spi; }
+};
+
+#define SPI_SCK_KHZ(speedKhz) SPIClock{1000UL * (speedKhz)} //get the speed in KHz
+#define SPI_SCK_MHZ(speedMhz) SPIClock{1000000UL * (speedMhz)} //get the speed in MHz
+#define SPI_INT_SDO 0xFF // INT pin argument: the chip signals the interrupt on MISO
+#define SPI_INT_POLL 0xFE // INT pin argument: no INT line, completion is polled in short bus windows (bus can be shared)
+
+#pragma region FastPin
+// A pin resolved once to its port registers, so toggling CS and polling INT skip the Arduino pin lookup.
+// Cores without a known register layout use digitalWrite/digitalRead.
+#if defined(ARDUINO_ARCH_AVR)
+#define CH376_FASTPIN_RMW // no set/clear registers, read-modify-write with interrupts locked
+typedef uint8_t CH376PinReg;
+#elif defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_SAMD)
+#define CH376_FASTPIN_SETCLR // OUT + 1 word: W1TS/OUTCLR, OUT + 2 words: W1TC/OUTSET
+typedef uint32_t CH376PinReg;
+#elif defined(ARDUINO_ARCH_STM32) || defined(ARDUINO_ARCH_SAM) || defined(ARDUINO_ARCH_ESP8266)
+#define CH376_FASTPIN_SETCLR
+typedef uint32_t CH376PinReg;
+#endif
+
+class CH376FastPin {
+public:
+	void begin(uint8_t pin) {
+		_pin = pin;
+#if defined(CH376_FASTPIN_RMW)
+		_out = portOutputRegister(digitalPinToPort(pin));
+		_in = portInputRegister(digitalPinToPort(pin));
+		_mask = digitalPinToBitMask(pin);
+#elif defined(ARDUINO_ARCH_ESP32)
+		volatile uint32_t* out = portOutputRegister(digitalPinToPort(pin));
+		_set = out + 1; // GPIO_OUT_W1TS / GPIO_OUT1_W1TS
+		_clr = out + 2; // GPIO_OUT_W1TC / GPIO_OUT1_W1TC
+		_in = portInputRegister(digitalPinToPort(pin));
+		_mask = _clrMask = digitalPinToBitMask(pin);
+#elif defined(ARDUINO_ARCH_SAMD)
+		volatile uint32_t* out = portOutputRegister(digitalPinToPort(pin));
+		_clr = out + 1; // PORT OUTCLR
+		_set = out + 2; // PORT OUTSET
+		_in = portInputRegister(digitalPinToPort(pin));
+		_mask = _clrMask = digitalPinToBitMask(pin);
+#elif defined(ARDUINO_ARCH_STM32)
+		GPIO_TypeDef* port = digitalPinToPort(pin);
+		_set = _clr = &port->BSRR; // low half sets, high half resets
+		_in = &port->IDR;
+		_mask = digitalPinToBitMask(pin);
+		_clrMask = _mask << 16;
+#elif defined(ARDUINO_ARCH_SAM)
+		Pio* port = digitalPinToPort(pin);
+		_set = &port->PIO_SODR;
+		_clr = &port->PIO_CODR;
+		_in = &port->PIO_PDSR;
+		_mask = _clrMask = digitalPinToBitMask(pin);
+#elif defined(ARDUINO_ARCH_ESP8266)
+		_set = &GPOS;
+		_clr = &GPOC;
+		_in = &GPI;
+		_mask = _clrMask = (pin < 16) ? (1UL << pin) : 0; // GPIO16 sits in the RTC block
+#endif
+	}
+	void high() {
+#if defined(CH376_FASTPIN_RMW)
+		uint8_t oldSREG = SREG;
+		cli(); // the INT ISR toggles CS of the same port
+		*_out |= _mask;
+		SREG = oldSREG;
+#elif defined(CH376_FASTPIN_SETCLR)
+		if (_mask) *_set = _mask;
+		else digitalWrite(_pin, HIGH);
+#else
+		digitalWrite(_pin, HIGH);
+#endif
+	}
+	void low() {
+#if defined(CH376_FASTPIN_RMW)
+		uint8_t oldSREG = SREG;
+		cli();
+		*_out &= ~_mask;
+		SREG = oldSREG;
+#elif defined(CH376_FASTPIN_SETCLR)
+		if (_mask) *_clr = _clrMask;
+		else digitalWrite(_pin, LOW);
+#else
+		digitalWrite(_pin, LOW);
+#endif
+	}
+	bool read() {
+#if defined(CH376_FASTPIN_RMW)
+		return (*_in & _mask) != 0;
+#elif defined(CH376_FASTPIN_SETCLR)
+		if (_mask) return (*_in & _mask) != 0;
+		return digitalRead(_pin);
+#else
+		return digitalRead(_pin);
+#endif
+	}
+
+private:
+	uint8_t _pin = 0;
+#if defined(CH376_FASTPIN_RMW)
+	volatile CH376PinReg* _out = NULL;
+	volatile CH376PinReg* _in = NULL;
+	CH376PinReg _mask = 0;
+#elif defined(CH376_FASTPIN_SETCLR)
+	volatile CH376PinReg* _set = NULL;
+	volatile CH376PinReg* _clr = NULL;
+	volatile const CH376PinReg* _in = NULL;
+	CH376PinReg _mask = 0; // 0 = pin without fast access, digitalWrite/digitalRead
+	CH376PinReg _clrMask = 0;
+#endif
+};
+#pragma endregion
+
+#pragma region SPI
+class CH376SPIPort {
+public:
+	static const bool pushesStatus = false;
+
+	CH376SPIPort(SPIClass& spiBus, uint8_t spiSelect, uint8_t intPin, SPIClock speed) {
+		_spi = &spiBus;
+		_spiChipSelect = spiSelect;
+		_intPin = (&spiBus == &SPI && intPin == MISO) ? SPI_INT_SDO : intPin;
+		setClock(speed);
+	}
+
+	void begin() {
+		if (!sdoInterrupt() && !pollInterrupt()) {
+			pinMode(_intPin, INPUT_PULLUP);
+		}
+		pinMode(_spiChipSelect, OUTPUT);
+		_csPin.begin(_spiChipSelect);
+		_csPin.high();
+		if (!pollInterrupt()) _irqPin.begin(sdoInterrupt() ? _misoPin : _intPin);
+#if defined(ARDUINO_ARCH_ESP32)
+		if (_customPins) _spi->begin(_sckPin, _misoPin, _mosiPin, -1);
+		else _spi->begin();
+#elif defined(ARDUINO_ARCH_ESP8266)
+		if (_customPins) _spi->pins(_sckPin, _misoPin, _mosiPin, _spiChipSelect);
+		_spi->begin();
+#elif defined(ARDUINO_ARCH_STM32)
+		if (_customPins) {
+			_spi->setSCLK(_sckPin);
+			_spi->setMISO(_misoPin);
+			_spi->setMOSI(_mosiPin);
+		}
+		_spi->begin();
+#else
+		_spi->begin();
+#endif
+	}
+	bool setPins(uint8_t sckPin, uint8_t misoPin, uint8_t mosiPin) { // before begin(), false if the core has fixed pins
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_STM32)
+		_sckPin = sckPin;
+		_misoPin = misoPin;
+		_mosiPin = mosiPin;
+		_customPins = true;
+		return true;
+#else
+		(void)sckPin;
+		(void)misoPin;
+		(void)mosiPin;
+		return false; // e.g. SAMD: the pins are given to the SPIClass(SERCOM) constructor
+#endif
+	}
+	void setClock(SPIClock speed) {
+		uint32_t halfPeriod = speed.hz ? 500000000UL / speed.hz : 0; // ns, the chip samples/shifts on the first clock edge of the data byte, unknown rate: full TSC
+		_spiClock = speed.hz;
+		_spiSpeed = speed.settings();
+		_tscDelay = (halfPeriod >= TSC_NS) ? 0 : (TSC_NS - halfPeriod + 999) / 1000;
+	}
+	uint32_t clock() { return _spiClock; } // Hz
+	bool sdoInterrupt() { return _intPin == SPI_INT_SDO; } // MISO doubles as INT line
+	bool pollInterrupt() { return _intPin == SPI_INT_POLL; } // no INT line at all
+
+	void beginTransfer() {
+		_spi->beginTransaction(_spiSpeed);
+		_csPin.low();
+	}
+	void endTransfer() {
+		_csPin.high();
+		_spi->endTransaction();
+		_tscPending = false;
+	}
+	void nextCommand() { // SCS high ends the command, the bus stays claimed
+		_csPin.high();
+		_tscPending = false;
+		_csPin.low();
+	}
+	void command(uint8_t cmd) {
+		_spi->transfer(cmd);
+		_tscPending = true;
+	}
+	void write(uint8_t data) {
+		tscPause();
+		_spi->transfer(data);
+	}
+	void write(const uint8_t* buffer, uint16_t b_size) {
+		tscPause();
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_ESP8266)
+		_spi->writeBytes((uint8_t*)buffer, b_size);
+#else
+		uint8_t chunk[SPI_CHUNK_LEN]; // transfer(buf, len) overwrites the buffer with the received bytes
+		while (b_size) {
+			uint8_t len = (b_size > sizeof(chunk)) ? sizeof(chunk) : b_size;
+			memcpy(chunk, buffer, len);
+			_spi->transfer(chunk, len);
+			buffer += len;
+			b_size -= len;
+		}
+#endif
+	}
+	uint8_t read() {
+		tscPause();
+		return _spi->transfer(0x00);
+	}
+	void read(uint8_t* buffer, uint16_t b_size) {
+		tscPause();
+		memset(buffer, 0x00, b_size); // clock out zeros, the received bytes replace them in place
+		_spi->transfer(buffer, b_size);
+	}
+#ifdef CH376_SPI_ASYNC
+	void writeAsync(const uint8_t* buffer, uint16_t b_size) {
+		tscPause();
+		_spi->transfer(buffer, NULL, b_size, false);
+	}
+	void readAsync(uint8_t* buffer, uint16_t b_size) {
+		tscPause();
+		_spi->transfer(NULL, buffer, b_size, false); // clocks out 0xFF, ignored by the chip
+	}
+	void waitData() { _spi->waitForTransfer(); }
+	static const bool asyncData = true;
+#else
+	void writeAsync(const uint8_t* buffer, uint16_t b_size) { write(buffer, b_size); }
+	void readAsync(uint8_t* buffer, uint16_t b_size) { read(buffer, b_size); }
+	void waitData() {}
+	static const bool asyncData = false;
+#endif
+	bool intActive() { return !_irqPin.read(); }
+	bool attachInt(void (*isr)()) {
+		if (sdoInterrupt() || pollInterrupt() || digitalPinToInterrupt(_intPin) == NOT_AN_INTERRUPT) return false; // MISO toggles with the data
+#ifdef SPI_HAS_NOTUSINGINTERRUPT
+		_spi->usingInterrupt(digitalPinToInterrupt(_intPin)); // keep the ISR out of other devices' transactions
+#endif
+		attachInterrupt(digitalPinToInterrupt(_intPin), isr, FALLING);
+		return true;
+	}
+	void detachInt() {
+		detachInterrupt(digitalPinToInterrupt(_intPin));
+#ifdef SPI_HAS_NOTUSINGINTERRUPT
+		_spi->notUsingInterrupt(digitalPinToInterrupt(_intPin));
+#endif
+	}
+#ifdef SPI_HAS_NOTUSINGINTERRUPT
+	static const bool latchInISR = true;
+#else
+	static const bool latchInISR = false;
+#endif
+
+private:
+	void tscPause() { // datasheet TSC, only needed between the command and its first data byte
+		if (_tscPending) {
+			_tscPending = false;
+			if (_tscDelay) delayMicroseconds(_tscDelay);
+		}
+	}
+
+	SPISettings _spiSpeed;
+	uint32_t _spiClock;
+	uint8_t _tscDelay = 2; // uSec pause after the command byte, see setClock()
+	bool _tscPending = false;
+	SPIClass* _spi;
+	uint8_t _spiChipSelect;
+	uint8_t _intPin;
+	uint8_t _sckPin = SCK;
+	uint8_t _misoPin = MISO;
+	uint8_t _mosiPin = MOSI;
+	bool _customPins = false;
+	CH376FastPin _csPin; // resolved in begin()
+	CH376FastPin _irqPin;
+};
+#pragma endregion
+
+#pragma region UART
+template <class SerialT>
+class CH376SerialPort {
+public:
+	static const bool pushesStatus = true; // without INT pin the chip sends the interrupt status byte on its own
+
+	CH376SerialPort(SerialT& serialPort, uint32_t speed) {
+		_serial = &serialPort;
+		_speed = speed;
+	}
+
+	void begin() { // default rate after power-up or reset
+		open(BaudRate9600);
+		while (_serial->available()) _serial->read(); // drop anything received before the reset
+	}
+	void open(uint32_t speed) {
+		_serial->begin(speed);
+		_serial->setTimeout(SER_CMD_TIMEOUT);
+	}
+	uint32_t speed() { return _speed; }
+
+	void beginTransfer() {}
+	void endTransfer() {}
+	void nextCommand() {} // every command starts with its own sync codes
+	void command(uint8_t cmd) {
+		uint8_t frame[3] = { SER_SYNC_CODE1, SER_SYNC_CODE2, cmd };
+		_serial->write(frame, sizeof(frame));
+	}
+	void write(uint8_t data) { _serial->write(data); }
+	void write(const uint8_t* buffer, uint16_t b_size) { _serial->write(buffer, b_size); }
+	uint8_t read() {
+		uint32_t oldMillis = millis();
+		while (!_serial->available()) {
+			if ((millis() - oldMillis) > SER_CMD_TIMEOUT) return 0x00;
+		}
+		return _serial->read();
+	}
+	void read(uint8_t* buffer, uint16_t b_size) {
+		uint16_t got = _serial->readBytes(buffer, b_size);
+		if (got < b_size) memset(buffer + got, 0x00, b_size - got);
+	}
+	void writeAsync(const uint8_t* buffer, uint16_t b_size) { write(buffer, b_size); } // no DMA on this bus
+	void readAsync(uint8_t* buffer, uint16_t b_size) { read(buffer, b_size); }
+	void waitData() {}
+	static const bool asyncData = false;
+	bool intActive() { return _serial->available() > 0; }
+	bool attachInt(void (*)()) { return false; }
+	void detachInt() {}
+	static const bool latchInISR = false;
+
+private:
+	SerialT* _serial;
+	uint32_t _speed;
+};
+#pragma endregion
+
+#pragma region Parallel
+class CH376ParallelPort {
+public:
+	static const bool pushesStatus = false;
+
+	CH376ParallelPort(const uint8_t dataPins[8], uint8_t a0Pin, uint8_t wrPin, uint8_t rdPin, uint8_t csPin) {
+		memcpy(_dataPins, dataPins, sizeof(_dataPins));
+		_a0Pin = a0Pin;
+		_wrPin = wrPin;
+		_rdPin = rdPin;
+		_csPin = csPin;
+	}
+
+	void begin() {
+		pinMode(_a0Pin, OUTPUT);
+		pinMode(_wrPin, OUTPUT);
+		pinMode(_rdPin, OUTPUT);
+		pinMode(_csPin, OUTPUT);
+		digitalWrite(_wrPin, HIGH);
+		digitalWrite(_rdPin, HIGH);
+		digitalWrite(_csPin, HIGH);
+		busInput();
+	}
+
+	void beginTransfer() { digitalWrite(_csPin, LOW); }
+	void endTransfer() { digitalWrite(_csPin, HIGH); }
+	void nextCommand() {} // A0 marks the command byte, CS may stay low
+	void command(uint8_t cmd) {
+		waitReady();
+		busWrite(HIGH, cmd); // A0 = 1 command port
+	}
+	void write(uint8_t data) {
+		waitReady();
+		busWrite(LOW, data); // A0 = 0 data port
+	}
+	void write(const uint8_t* buffer, uint16_t b_size) {
+		while (b_size--) write(*buffer++);
+	}
+	uint8_t read() {
+		waitReady();
+		return busRead(LOW);
+	}
+	void read(uint8_t* buffer, uint16_t b_size) {
+		while (b_size--) *buffer++ = read();
+	}
+	void writeAsync(const uint8_t* buffer, uint16_t b_size) { write(buffer, b_size); } // no DMA on this bus
+	void readAsync(uint8_t* buffer, uint16_t b_size) { read(buffer, b_size); }
+	void waitData() {}
+	static const bool asyncData = false;
+	bool intActive() { return !(status() & PARA_STATE_INTB); }
+	bool attachInt(void (*)()) { return false; }
+	void detachInt() {}
+	static const bool latchInISR = false;
+
+private:
+	uint8_t status() { // read the status port, A0 = 1
+		digitalWrite(_csPin, LOW);
+		uint8_t tmpRet = busRead(HIGH);
+		digitalWrite(_csPin, HIGH);
+		return tmpRet;
+	}
+	void waitReady() { // the chip is busy while processing a command byte, this replaces the TSC pause
+		uint32_t oldMillis = millis();
+		while (busRead(HIGH) & PARA_STATE_BUSY) {
+			if ((millis() - oldMillis) > SER_CMD_TIMEOUT) break;
+		}
+	}
+	void busInput() {
+		for (uint8_t i = 0; i < 8; i++) pinMode(_dataPins[i], INPUT);
+	}
+	void busWrite(uint8_t a0, uint8_t data) {
+		digitalWrite(_a0Pin, a0);
+		for (uint8_t i = 0; i < 8; i++) {
+			pinMode(_dataPins[i], OUTPUT);
+			digitalWrite(_dataPins[i], (data >> i) & 0x01);
+		}
+		digitalWrite(_wrPin, LOW);
+		digitalWrite(_wrPin, HIGH);
+		busInput();
+	}
+	uint8_t busRead(uint8_t a0) {
+		uint8_t data = 0;
+		digitalWrite(_a0Pin, a0);
+		digitalWrite(_rdPin, LOW);
+		for (uint8_t i = 0; i < 8; i++) {
+			if (digitalRead(_dataPins[i])) data |= (1 << i);
+		}
+		digitalWrite(_rdPin, HIGH);
+		return data;
+	}
+
+	uint8_t _dataPins[8];
+	uint8_t _a0Pin;
+	uint8_t _wrPin;
+	uint8_t _rdPin;
+	uint8_t _csPin;
+};
+#pragma endregion
+
+#ifdef CH376_SOFTWARE_SERIAL
+typedef SoftwareSerial CH376SerialType;
+#else
+typedef HardwareSerial CH376SerialType;
+#endif
+#endif // Arduino backends
+
+#pragma region Linux
+#if CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+class CH376LinuxPort { // the bytes of a transfer are queued and go out as one SPI message per read() or endTransfer()
+public:
+	static const bool pushesStatus = false;
+
+	CH376LinuxPort(CH376LinuxHAL& hal) { _hal = &hal; }
+
+	void begin() { _hal->begin(); }
+	void beginTransfer() { _hal->select(true); }
+	void endTransfer() {
+		flush();
+		_hal->select(false);
+	}
+	void nextCommand() {
+		endTransfer();
+		_hal->select(true);
+	}
+	void command(uint8_t command) {
+		queue(&command, NULL, 1);
+		_xfer[_xferCount - 1].delayUs = (TSC_NS + 999) / 1000;
+	}
+	void write(uint8_t data) { queue(&data, NULL, 1); }
+	void write(const uint8_t* buffer, uint16_t b_size) { queue(buffer, NULL, b_size); }
+	uint8_t read() {
+		uint8_t data = 0;
+		queue(NULL, &data, 1);
+		flush();
+		return data;
+	}
+	void read(uint8_t* buffer, uint16_t b_size) {
+		queue(NULL, buffer, b_size);
+		flush();
+	}
+	void writeAsync(const uint8_t* buffer, uint16_t b_size) { write(buffer, b_size); }
+	void readAsync(uint8_t* buffer, uint16_t b_size) { read(buffer, b_size); }
+	void waitData() {}
+	static const bool asyncData = false;
+	bool intActive() { return _hal->intActive(); }
+	bool attachInt(void (*)()) { return false; } // completion is polled on INT#
+	void detachInt() {}
+	static const bool latchInISR = false;
+
+private:
+	void queue(const uint8_t* tx, uint8_t* rx, uint16_t len) {
+		bool copied = tx && len <= sizeof(_txBuf);
+		if (_xferCount == CH376_LINUX_XFERS || (tx && _txLen + len > sizeof(_txBuf))) flush();
+		if (copied) { // small writes are copied, so they can be merged into one segment
+			CH376LinuxXfer* last = _xferCount ? &_xfer[_xferCount - 1] : NULL;
+			memcpy(&_txBuf[_txLen], tx, len);
+			tx = &_txBuf[_txLen];
+			_txLen += len;
+			if (last && !last->rx && !last->delayUs && last->tx + last->len == tx) {
+				last->len += len;
+				return;
+			}
+		}
+		CH376LinuxXfer& xfer = _xfer[_xferCount++];
+		xfer.tx = tx;
+		xfer.rx = rx;
+		xfer.len = len;
+		xfer.delayUs = 0;
+		if (tx && !copied) flush(); // large block, send it while the caller's buffer is valid
+	}
+	void flush() {
+		if (_xferCount) _hal->transfer(_xfer, _xferCount);
+		_xferCount = 0;
+		_txLen = 0;
+	}
+
+	CH376LinuxHAL* _hal;
+	CH376LinuxXfer _xfer[CH376_LINUX_XFERS];
+	uint8_t _xferCount = 0;
+	uint8_t _txBuf[CH376_DAT_BLOCK_LEN + 8]; // one data block and its command
+	uint16_t _txLen = 0;
+};
+#endif
+#pragma endregion
+
+#if CH376_TRANSPORT == CH376_TRANSPORT_UART
+typedef CH376SerialPort<CH376SerialType> CH376Port;
+#elif CH376_TRANSPORT == CH376_TRANSPORT_PARALLEL
+typedef CH376ParallelPort CH376Port;
+#elif CH376_TRANSPORT == CH376_TRANSPORT_LINUX
+typedef CH376LinuxPort CH376Port;
+#else
+typedef CH376SPIPort CH376Port;
+#endif
+
+#endif // CH376PORT_H
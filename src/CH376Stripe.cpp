@@ -0,0 +1,175 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "CH376Stripe.h"
+
+CH376Stripe::CH376Stripe(CH376MSC* const drives[], uint8_t count, uint16_t chunkSize) {
+	_count = min(count, (uint8_t)CH376_STRIPE_MAX);
+	for (uint8_t i = 0; i < _count; i++) {
+		_drives[i] = drives[i];
+	}
+	_chunkSize = min(max(((uint32_t)chunkSize + CH376_DAT_BLOCK_LEN - 1) / CH376_DAT_BLOCK_LEN, (uint32_t)1), (uint32_t)(0xFFFF / CH376_DAT_BLOCK_LEN))
+		* CH376_DAT_BLOCK_LEN; // whole USB packets, 0 would never advance in write()
+	_filename[0] = '\0';
+}
+
+bool CH376Stripe::begin() {
+	bool tmpRet = true;
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!_drives[i]->setAsyncMode(true)) tmpRet = false; // still works, but the drive is polled and overlaps less
+	}
+	return tmpRet;
+}
+
+#pragma region Write
+bool CH376Stripe::create(const char* filename) {
+	strncpy(_filename, filename, sizeof(_filename) - 1);
+	_filename[sizeof(_filename) - 1] = '\0';
+	for (uint8_t i = 0; i < _count; i++) {
+		CH376MSC* drive = _drives[i];
+		if (!drive->getDeviceStatus()) return false;
+		drive->setFileName(_filename);
+		if (drive->openFile() == USB_INT_SUCCESS) {
+			drive->deleteFile();
+			drive->setFileName(_filename);
+			drive->openFile(); // ERR_MISS_FILE, the first write creates it
+		}
+	}
+	_current = 0;
+	_chunkPos = 0;
+	_length = 0;
+	return true;
+}
+
+uint32_t CH376Stripe::write(const uint8_t* buffer, uint32_t length) {
+	uint32_t tmpDone = 0;
+	while (tmpDone < length) {
+		uint32_t piece = min(length - tmpDone, (uint32_t)(_chunkSize - _chunkPos));
+		if (!_drives[_current]->writeRaw((uint8_t*)buffer + tmpDone, piece)) break; // disk full or gone
+		tmpDone += piece;
+		_chunkPos += piece;
+		_length += piece;
+		if (_chunkPos == _chunkSize) nextChunk(); // this drive commits while the next one is filled
+	}
+	return tmpDone;
+}
+
+bool CH376Stripe::close() {
+	bool tmpRet = true;
+	for (uint8_t i = 0; i < _count; i++) {
+		_drives[i]->closeFile(); // deferred in async mode, all drives close at the same time
+	}
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!writeManifest(i)) tmpRet = false;
+	}
+	return tmpRet;
+}
+
+bool CH376Stripe::writeManifest(uint8_t drive) {
+	CH376MSC* tmpDrive = _drives[drive];
+	CH376StripeManifest manifest = { CH376_STRIPE_MAGIC, CH376_STRIPE_VERSION, drive, _count, 0, _chunkSize, 0, _length };
+	char name[13];
+	bool tmpRet;
+	manifestName(name);
+	tmpDrive->setFileName(name);
+	if (tmpDrive->openFile() == USB_INT_SUCCESS) { // the new manifest may be shorter, don't leave old bytes behind
+		tmpDrive->deleteFile();
+		tmpDrive->setFileName(name);
+		tmpDrive->openFile();
+	}
+	tmpRet = tmpDrive->writeRaw((uint8_t*)&manifest, sizeof(manifest));
+	tmpDrive->closeFile();
+	tmpDrive->commandStatus();
+	return tmpRet && tmpDrive->getDeviceStatus();
+}
+#pragma endregion
+
+#pragma region Read
+bool CH376Stripe::open(const char* filename) {
+	strncpy(_filename, filename, sizeof(_filename) - 1);
+	_filename[sizeof(_filename) - 1] = '\0';
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!readManifest(i)) return false;
+		_drives[i]->setFileName(_filename);
+		if (_drives[i]->openFile() != USB_INT_SUCCESS) return false;
+	}
+	_current = 0;
+	_chunkPos = 0;
+	_position = 0;
+	return true;
+}
+
+bool CH376Stripe::readManifest(uint8_t drive) {
+	CH376MSC* tmpDrive = _drives[drive];
+	CH376StripeManifest manifest;
+	char name[13];
+	manifestName(name);
+	tmpDrive->setFileName(name);
+	if (tmpDrive->openFile() != USB_INT_SUCCESS) return false;
+	tmpDrive->readRaw((uint8_t*)&manifest, sizeof(manifest));
+	tmpDrive->closeFile();
+	if (tmpDrive->getStreamLen() != sizeof(manifest) || manifest.magic != CH376_STRIPE_MAGIC
+		|| manifest.version != CH376_STRIPE_VERSION || manifest.drive != drive || manifest.count != _count
+		|| manifest.chunkSize == 0) {
+		return false; // not a stripe, or the drives are plugged in a different order
+	}
+	_chunkSize = manifest.chunkSize;
+	_length = manifest.length;
+	return true;
+}
+
+uint32_t CH376Stripe::read(uint8_t* buffer, uint32_t length) {
+	uint32_t tmpDone = 0;
+	size_t received;
+	while (tmpDone < length && _position < _length) {
+		uint32_t piece = min(length - tmpDone, (uint32_t)(_chunkSize - _chunkPos));
+		piece = min(piece, _length - _position);
+		_drives[_current]->readRaw(buffer + tmpDone, piece);
+		received = _drives[_current]->getStreamLen();
+		tmpDone += received;
+		_chunkPos += received;
+		_position += received;
+		if (received < piece) break; // the drive's file is shorter than the manifest says
+		if (_chunkPos == _chunkSize) nextChunk();
+	}
+	return tmpDone;
+}
+#pragma endregion
+
+void CH376Stripe::nextChunk() {
+	_chunkPos = 0;
+	if (++_current == _count) _current = 0;
+}
+
+void CH376Stripe::manifestName(char* name) { // NAME.EXT -> NAME.MAN
+	uint8_t len = 0;
+	while (_filename[len] && _filename[len] != '.' && len < 8) {
+		name[len] = _filename[len];
+		len++;
+	}
+	strcpy(&name[len], ".MAN");
+}
+
+uint32_t CH376Stripe::getLength() { return _length; }
+uint16_t CH376Stripe::getChunkSize() { return _chunkSize; }
+uint8_t CH376Stripe::getDriveCount() { return _count; }
@@ -0,0 +1,86 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef CH376STRIPE_H
+#define CH376STRIPE_H
+
+#include "CH376MSC.h"
+
+// Several CH376MSC instances on one SPIClass (each with its own CS and INT pin) written as one stream.
+// The stream is cut into chunkSize pieces dealt round-robin to the drives: chunk n goes to drive n % count.
+// In async mode a drive commits its BYTE_WR_GO in the background while the next drive is being filled.
+// Every drive also gets <name>.MAN with a CH376StripeManifest, so the stream can be put together again.
+
+#ifndef CH376_STRIPE_MAX
+#define CH376_STRIPE_MAX 4 // drives per stripe set
+#endif
+#if CH376_INT_SLOTS < CH376_STRIPE_MAX
+#error "CH376_INT_SLOTS must be at least CH376_STRIPE_MAX, every striped drive needs its own ISR slot"
+#endif
+
+#define CH376_STRIPE_MAGIC 0x54534843UL // "CHST"
+#define CH376_STRIPE_VERSION 1
+
+struct CH376StripeManifest { // little endian, 16 bytes
+	uint32_t magic;
+	uint8_t version;
+	uint8_t drive; // position of this drive in the set
+	uint8_t count; // drives in the set
+	uint8_t reserved;
+	uint16_t chunkSize;
+	uint16_t reserved2;
+	uint32_t length; // bytes of the whole stream
+};
+
+class CH376Stripe {
+public:
+	CH376Stripe(CH376MSC* const drives[], uint8_t count, uint16_t chunkSize = 512);
+
+	bool begin(); // after init() of the drives, true if every drive completes on its INT pin ISR
+	bool create(const char* filename); // 8.3 name, an existing stream is replaced
+	uint32_t write(const uint8_t* buffer, uint32_t length); // append, returns the bytes written
+	bool close(); // finish every drive and write the manifests
+	bool open(const char* filename); // read back a stream written by the same set
+	uint32_t read(uint8_t* buffer, uint32_t length); // returns the bytes read, 0 at the end of the stream
+
+	uint32_t getLength();
+	uint16_t getChunkSize();
+	uint8_t getDriveCount();
+
+private:
+	void nextChunk();
+	bool writeManifest(uint8_t drive);
+	bool readManifest(uint8_t drive);
+	void manifestName(char* name);
+
+	CH376MSC* _drives[CH376_STRIPE_MAX];
+	uint8_t _count;
+	uint16_t _chunkSize;
+	uint8_t _current = 0; // drive of the current chunk
+	uint16_t _chunkPos = 0; // bytes of the current chunk done
+	uint32_t _length = 0;
+	uint32_t _position = 0; // read position in the stream
+	char _filename[13];
+};
+
+#endif // CH376STRIPE_H